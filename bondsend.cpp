@@ -0,0 +1,189 @@
+///////////////////////////////////////////////////////////////////////
+// bondsend.cpp -- Send a file striped over several ESP8266 modules
+// Date: Sun Oct 18 16:58:44 2026
+///////////////////////////////////////////////////////////////////////
+//
+// Each -d option adds one module. All modules connect to the bondsrv
+// server given by -c host -p port, and the input (-f file, else stdin)
+// is striped across them with ESPBond. Per link statistics are shown
+// at the end.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "espbond.hpp"
+#include "espserial.hpp"
+
+static int opt_baudrate = 115200;
+static const char *opt_host = 0;
+static int opt_port = 9000;
+static const char *opt_file = 0;
+static unsigned long opt_timeout = 5000;
+static bool opt_probe = false;
+static bool opt_verbose = false;
+
+struct s_module {
+	ESPSerial	serial;		// Must precede esp
+	ESP8266		esp;
+	const char	*device;
+
+	s_module()
+		: esp(ESPSerial::writeb,ESPSerial::readb,ESPSerial::rpoll,ESPSerial::idle,&serial),
+		  device(0) {}
+};
+
+static s_module modules[ESPBond::MaxLinks];
+
+static void
+usage(const char *cmd) {
+	const char *cp = strrchr(cmd,'/');
+
+	if ( cp )
+		cmd = cp + 1;
+
+	fprintf(stderr,
+		"Usage: %s -d device [-d device...] -c host [-options..] [-B] [-v] [-h]\n"
+		"where options include:\n"
+		"\t-d device\tSerial device pathname (repeat for each module)\n"
+		"\t-b baudrate\tSerial baud rate (115200)\n"
+		"\t-c host\t\tbondsrv host\n"
+		"\t-p port\t\tbondsrv port (9000)\n"
+		"\t-f file\t\tFile to send (stdin)\n"
+		"\t-t ms\t\tLink watchdog timeout (5000)\n"
+		"\t-B\t\tFind each module's baud rate, then raise it\n"
+		"\t-v\t\tVerbose output mode\n"
+		"\t-h\t\tThis help info.\n",
+		cmd);
+	exit(0);
+}
+
+int
+main(int argc,char **argv) {
+	static const char options[] = ":d:b:c:p:f:t:Bvh";
+	static char buf[64*1024];
+	int ndevices = 0, optch, er = 0, fd = 0, rc;
+	unsigned long total = 0;
+
+	while ( (optch = getopt(argc,argv,options)) != -1 ) {
+		switch ( optch ) {
+		case 'd':
+			if ( ndevices >= ESPBond::MaxLinks ) {
+				fprintf(stderr,"Too many devices (max %d)\n",ESPBond::MaxLinks);
+				++er;
+			} else	modules[ndevices++].device = optarg;
+			break;
+		case 'b':
+			opt_baudrate = atoi(optarg);
+			break;
+		case 'c':
+			opt_host = optarg;
+			break;
+		case 'p':
+			opt_port = atoi(optarg);
+			break;
+		case 'f':
+			opt_file = optarg;
+			break;
+		case 't':
+			opt_timeout = strtoul(optarg,0,10);
+			break;
+		case 'B':
+			opt_probe = true;
+			break;
+		case 'v':
+			opt_verbose = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			break;
+		case ':':
+			fprintf(stderr,"Missing argument for -%c\n",optopt);
+			++er;
+			break;
+		default:
+			fprintf(stderr,"Invalid option -%c\n",optopt);
+			++er;
+		}
+	}
+
+	if ( er > 0 || ndevices < 1 || !opt_host ) {
+		fprintf(stderr,"Use option -h for more information.\n");
+		exit(1);
+	}
+
+	if ( opt_file ) {
+		fd = open(opt_file,O_RDONLY);
+		if ( fd == -1 ) {
+			fprintf(stderr,"%s: opening %s for read\n",strerror(errno),opt_file);
+			exit(2);
+		}
+	}
+
+	ESPBond bond;
+
+	bond.set_timeout(opt_timeout);
+
+	for ( int x=0; x<ndevices; ++x ) {
+		s_module& mod = modules[x];
+
+		if ( !mod.serial.open(mod.device,opt_baudrate) ) {
+			fprintf(stderr,"Unable to open %s\n",mod.device);
+			exit(3);
+		}
+		if ( opt_probe ) {
+			if ( !mod.serial.probe_baud(true) ) {
+				fprintf(stderr,"No response from %s at any baud rate\n",mod.device);
+				exit(3);
+			}
+			if ( opt_verbose )
+				printf("%s at %d baud\n",mod.device,mod.serial.get_baudrate());
+		}
+		if ( !mod.esp.start() ) {
+			fprintf(stderr,"Unable to start ESP8266 on %s\n",mod.device);
+			exit(13);
+		}
+		bond.add(mod.esp);
+	}
+
+	rc = bond.connect(opt_host,opt_port);
+	if ( rc < 1 ) {
+		fprintf(stderr,"No link could connect to %s:%d\n",opt_host,opt_port);
+		exit(13);
+	}
+	if ( opt_verbose )
+		printf("%d of %d links connected.\n",rc,ndevices);
+
+	while ( (rc = read(fd,buf,sizeof buf)) > 0 ) {
+		if ( bond.send(buf,rc) != rc ) {
+			fprintf(stderr,"All links failed after %lu bytes\n",total);
+			exit(13);
+		}
+		total += rc;
+	}
+
+	ESPBond::LinkStats st;
+
+	for ( int x=0; x<ndevices; ++x ) {
+		bond.get_stats(x,st);
+		printf("  %-24s %-4s chunks %7lu bytes %9lu failures %3lu latency %7lu us\n",
+			modules[x].device,
+			st.up ? "ok" : "down",
+			st.chunks,st.bytes,st.failures,st.latency_us);
+	}
+	printf("Sent %lu bytes.\n",total);
+
+	if ( !bond.finish() )
+		fprintf(stderr,"Unable to send end of stream.\n");
+
+	if ( fd != 0 )
+		close(fd);
+	return 0;
+}
+
+// End bondsend.cpp
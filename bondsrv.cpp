@@ -0,0 +1,367 @@
+///////////////////////////////////////////////////////////////////////
+// bondsrv.cpp -- Reassemble an ESPBond stream from several connections
+// Date: Sun Oct 18 16:40:07 2026
+///////////////////////////////////////////////////////////////////////
+//
+// Accepts the per-module TCP connections of one ESPBond session (see
+// espbond.hpp), puts the chunks back in sequence order and writes the
+// data to -o file (else stdout). Exits when the End chunk has arrived
+// and all chunks before it have been written.
+//
+// The first Hello sets the session: a connection whose Hello carries
+// another session id, or that sends chunks before its Hello, is closed.
+// A chunk too far ahead of the next one to write is left unread, with
+// its connection, until the reorder window reaches it (TCP then holds
+// back that link's sender).
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "espbond.hpp"
+
+static int opt_port = 9000;
+static const char *opt_output = 0;
+static bool opt_verbose = false;
+
+enum {
+	MaxConns = 1 + ESPBond::MaxLinks,
+	Slots = ESPBond::Window * 2		// Reorder window
+};
+
+struct s_conn {
+	int		fd;			// Connection, else -1
+	unsigned char	buf[ESPBond::HdrSize+ESPBond::ChunkSize];
+	int		len;			// Bytes in buf
+	bool		hello;			// Hello received (session matched)
+	bool		held;			// Chunk in buf awaits the window
+	unsigned long	chunks;			// Chunks received
+};
+
+struct s_slot {
+	bool		full;
+	unsigned long	seq;
+	int		len;
+	char		data[ESPBond::ChunkSize];
+};
+
+static s_conn conns[MaxConns];
+static s_slot *slots;
+static int outfd = 1;
+
+static unsigned long session = 0;		// Session id (first Hello)
+static bool have_session = false;
+static unsigned long next_seq = 0;		// Next chunk to write
+static unsigned long end_seq = 0;		// Chunk count, once End arrives
+static bool have_end = false;
+static unsigned long dups = 0;			// Duplicate chunks dropped
+
+static unsigned long
+get32(const unsigned char *bp) {
+	return (unsigned long)bp[0] << 24 | bp[1] << 16 | bp[2] << 8 | bp[3];
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write out chunks that are now in sequence
+//////////////////////////////////////////////////////////////////////
+
+static void
+flush_slots() {
+
+	for (;;) {
+		s_slot& slot = slots[next_seq % Slots];
+
+		if ( !slot.full || slot.seq != next_seq )
+			break;
+		if ( write(outfd,slot.data,slot.len) != slot.len ) {
+			perror("write");
+			exit(5);
+		}
+		slot.full = false;
+		++next_seq;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Handle one complete chunk from connection cx. Returns 1 when taken,
+// 0 when it is outside the window (try again later), else -1 to close
+// the connection.
+//////////////////////////////////////////////////////////////////////
+
+static int
+chunk(int cx,const unsigned char *hdr,const char *data,int len) {
+	s_conn& conn = conns[cx];
+	unsigned flags = hdr[2];
+	unsigned long seq = get32(hdr+4);
+
+	if ( flags & ESPBond::Hello ) {
+		if ( !have_session ) {
+			session = seq;
+			have_session = true;
+		} else if ( seq != session ) {
+			fprintf(stderr,"Conn %d: session %08lX is not %08lX\n",cx,seq,session);
+			return -1;
+		}
+		conn.hello = true;
+		if ( opt_verbose )
+			fprintf(stderr,"Conn %d: session %08lX\n",cx,seq);
+		return 1;
+	}
+
+	if ( !conn.hello ) {
+		fprintf(stderr,"Conn %d: chunk before Hello\n",cx);
+		return -1;
+	}
+
+	if ( flags & ESPBond::End ) {
+		have_end = true;
+		end_seq = seq;
+		if ( opt_verbose )
+			fprintf(stderr,"Conn %d: end after %lu chunks\n",cx,seq);
+		return 1;
+	}
+
+	if ( seq < next_seq ) {
+		++conn.chunks;
+		++dups;				// Resent after a link failure
+		return 1;
+	}
+
+	if ( seq >= next_seq + Slots )
+		return 0;			// Wait for the window to move
+
+	s_slot& slot = slots[seq % Slots];
+
+	++conn.chunks;
+	if ( slot.full ) {
+		++dups;
+		return 1;
+	}
+
+	slot.full = true;
+	slot.seq = seq;
+	slot.len = len;
+	memcpy(slot.data,data,len);
+	flush_slots();
+	return 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Parse the complete chunks buffered for connection cx. Returns false
+// if the connection must be closed.
+//////////////////////////////////////////////////////////////////////
+
+static bool
+parse(int cx) {
+	s_conn& conn = conns[cx];
+	int len, rc;
+
+	conn.held = false;
+
+	while ( conn.len >= ESPBond::HdrSize ) {
+		if ( conn.buf[0] != 'E' || conn.buf[1] != 'B' ) {
+			fprintf(stderr,"Conn %d: bad chunk header\n",cx);
+			return false;
+		}
+		len = conn.buf[8] << 8 | conn.buf[9];
+		if ( len > ESPBond::ChunkSize ) {
+			fprintf(stderr,"Conn %d: chunk too long (%d)\n",cx,len);
+			return false;
+		}
+		if ( conn.len < ESPBond::HdrSize + len )
+			break;			// Partial chunk
+
+		rc = chunk(cx,conn.buf,(const char *)conn.buf+ESPBond::HdrSize,len);
+		if ( rc < 0 )
+			return false;
+		if ( rc == 0 ) {
+			conn.held = true;	// Stop reading until it fits
+			break;
+		}
+
+		conn.len -= ESPBond::HdrSize + len;
+		memmove(conn.buf,conn.buf+ESPBond::HdrSize+len,conn.len);
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read from connection cx, parsing any complete chunks
+//////////////////////////////////////////////////////////////////////
+
+static bool
+service(int cx) {
+	s_conn& conn = conns[cx];
+	int rc;
+
+	if ( conn.held )
+		return true;			// Not read until its chunk fits
+
+	rc = read(conn.fd,conn.buf+conn.len,sizeof conn.buf-conn.len);
+	if ( rc <= 0 )
+		return false;
+	conn.len += rc;
+	return parse(cx);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Close connection cx
+//////////////////////////////////////////////////////////////////////
+
+static void
+drop(int cx) {
+
+	if ( opt_verbose )
+		fprintf(stderr,"Conn %d: closed after %lu chunks\n",cx,conns[cx].chunks);
+	close(conns[cx].fd);
+	conns[cx].fd = -1;
+	conns[cx].held = false;
+}
+
+static void
+usage(const char *cmd) {
+	const char *cp = strrchr(cmd,'/');
+
+	if ( cp )
+		cmd = cp + 1;
+
+	fprintf(stderr,
+		"Usage: %s [-p port] [-o file] [-v] [-h]\n"
+		"where options include:\n"
+		"\t-p port\t\tListen on port (9000)\n"
+		"\t-o file\t\tWrite received data to file (stdout)\n"
+		"\t-v\t\tVerbose output mode\n"
+		"\t-h\t\tThis help info.\n",
+		cmd);
+	exit(0);
+}
+
+int
+main(int argc,char **argv) {
+	static const char options[] = ":p:o:vh";
+	struct sockaddr_in addr;
+	struct pollfd pfds[MaxConns];
+	int optch, er = 0, lfd, on = 1;
+
+	while ( (optch = getopt(argc,argv,options)) != -1 ) {
+		switch ( optch ) {
+		case 'p':
+			opt_port = atoi(optarg);
+			break;
+		case 'o':
+			opt_output = optarg;
+			break;
+		case 'v':
+			opt_verbose = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			break;
+		case ':':
+			fprintf(stderr,"Missing argument for -%c\n",optopt);
+			++er;
+			break;
+		default:
+			fprintf(stderr,"Invalid option -%c\n",optopt);
+			++er;
+		}
+	}
+
+	if ( er > 0 ) {
+		fprintf(stderr,"Use option -h for more information.\n");
+		exit(1);
+	}
+
+	if ( opt_output ) {
+		outfd = open(opt_output,O_WRONLY|O_CREAT|O_TRUNC,0644);
+		if ( outfd == -1 ) {
+			fprintf(stderr,"%s: opening %s for write\n",strerror(errno),opt_output);
+			exit(2);
+		}
+	}
+
+	slots = (s_slot *)calloc(Slots,sizeof *slots);
+
+	lfd = socket(AF_INET,SOCK_STREAM,0);
+	setsockopt(lfd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof on);
+	memset(&addr,0,sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opt_port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if ( bind(lfd,(struct sockaddr *)&addr,sizeof addr) == -1 || listen(lfd,MaxConns) == -1 ) {
+		fprintf(stderr,"%s: listening on port %d\n",strerror(errno),opt_port);
+		exit(3);
+	}
+
+	conns[0].fd = lfd;
+	for ( int x=1; x<MaxConns; ++x )
+		conns[x].fd = -1;
+
+	while ( !have_end || next_seq < end_seq ) {
+		for ( int x=0; x<MaxConns; ++x ) {
+			pfds[x].fd = conns[x].held ? -1 : conns[x].fd;
+			pfds[x].events = POLLIN;
+			pfds[x].revents = 0;
+		}
+
+		if ( poll(pfds,MaxConns,-1) == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			perror("poll");
+			exit(4);
+		}
+
+		if ( pfds[0].revents & POLLIN ) {
+			int fd = accept(lfd,0,0), x;
+
+			for ( x=1; fd >= 0 && x<MaxConns && conns[x].fd >= 0; ++x )
+				;
+			if ( fd >= 0 && x < MaxConns ) {
+				conns[x].fd = fd;
+				conns[x].len = 0;
+				conns[x].hello = false;
+				conns[x].held = false;
+				conns[x].chunks = 0;
+				if ( opt_verbose )
+					fprintf(stderr,"Conn %d: accepted\n",x);
+			} else if ( fd >= 0 )
+				close(fd);
+		}
+
+		unsigned long seq = next_seq;
+
+		for ( int x=1; x<MaxConns; ++x ) {
+			if ( conns[x].fd < 0 || !pfds[x].revents )
+				continue;
+			if ( !service(x) )
+				drop(x);
+		}
+
+		// Retry held chunks while the window moves
+		while ( seq != next_seq ) {
+			seq = next_seq;
+			for ( int x=1; x<MaxConns; ++x )
+				if ( conns[x].fd >= 0 && conns[x].held && !parse(x) )
+					drop(x);
+		}
+	}
+
+	if ( opt_verbose )
+		fprintf(stderr,"Received %lu chunks (%lu duplicates)\n",next_seq,dups);
+
+	if ( outfd != 1 )
+		close(outfd);
+	return 0;
+}
+
+// End bondsrv.cpp
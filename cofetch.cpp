@@ -0,0 +1,187 @@
+///////////////////////////////////////////////////////////////////////
+// cofetch.cpp -- Concurrent fetches using ESP8266 coroutines
+// Date: Sun Oct 18 19:41:05 2026
+///////////////////////////////////////////////////////////////////////
+//
+// One coroutine per host named on the command line connects to the
+// -p port, sends "GET /" and counts the bytes received until the
+// remote closes (or -m bytes have arrived). All flows share one
+// module, and run concurrently in one thread (see espco.hpp).
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "espco.hpp"
+#include "espserial.hpp"
+
+static int opt_baudrate = 115200;
+static int opt_port = 80;
+static int opt_max = -1;
+static bool opt_probe = false;
+static bool opt_verbose = false;
+static const char *opt_device = "/dev/cu.usbserial-A50285BI";
+
+typedef ESPCo<ESP8266> Co;
+
+//////////////////////////////////////////////////////////////////////
+// One fetch
+//////////////////////////////////////////////////////////////////////
+
+static ESPTask
+fetch(Co& co,const char *host) {
+	static const char request[] = "GET /\r\n";
+	char buf[128];
+	long total = 0;
+	int sock, n;
+
+	sock = co_await co.connect(host,opt_port);
+	if ( sock < 0 ) {
+		printf("%s: connect failed\n",host);
+		co_return;
+	}
+	if ( opt_verbose )
+		printf("%s: connected on sock %d\n",host,sock);
+
+	if ( co_await co.send(sock,request,sizeof request - 1) < 0 ) {
+		printf("%s: send failed\n",host);
+		co_await co.close(sock);
+		co_return;
+	}
+
+	while ( opt_max < 0 || total < opt_max ) {
+		n = co_await co.recv(sock,buf,sizeof buf);
+		if ( n <= 0 )
+			break;			// Closed
+		total += n;
+		if ( opt_verbose )
+			printf("%s: %d bytes\n",host,n);
+	}
+
+	co_await co.close(sock);
+	printf("%s: %ld bytes received\n",host,total);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Command line usage
+//////////////////////////////////////////////////////////////////////
+
+static void
+usage(const char *cmd) {
+	const char *cp = strrchr(cmd,'/');
+
+	if ( cp )
+		cmd = cp + 1;
+
+	fprintf(stderr,
+		"Usage: %s [-b baudrate] [-d device] [-p port] [-m bytes] [-B] [-v] [-h] host...\n"
+		"where options include:\n"
+		"\t-b baudrate\tSerial baud rate (115200)\n"
+		"\t-d device\tSerial device pathname\n"
+		"\t-p port\t\tPort to connect to (80)\n"
+		"\t-m bytes\tStop each fetch after bytes received\n"
+		"\t-B\t\tFind the module's baud rate, then raise it\n"
+		"\t-v\t\tVerbose output mode\n"
+		"\t-h\t\tThis help info.\n",
+		cmd);
+	exit(0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Fetch from each host on the command line, concurrently
+//////////////////////////////////////////////////////////////////////
+
+int
+main(int argc,char **argv) {
+	static const char options[] = ":b:d:p:m:Bvh";
+	int optch, er = 0;
+
+	while ( (optch = getopt(argc,argv,options)) != -1 ) {
+		switch ( optch ) {
+		case 'b':
+			opt_baudrate = atoi(optarg);
+			break;
+		case 'd':
+			opt_device = optarg;
+			break;
+		case 'p':
+			opt_port = atoi(optarg);
+			break;
+		case 'm':
+			opt_max = atoi(optarg);
+			break;
+		case 'B':
+			opt_probe = true;
+			break;
+		case 'v':
+			opt_verbose = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			break;
+		case ':':
+			fprintf(stderr,"Missing argument for -%c\n",optopt);
+			++er;
+			break;
+		default:
+			fprintf(stderr,"Invalid option -%c\n",optopt);
+			++er;
+		}
+	}
+
+	if ( er > 0 || optind >= argc ) {
+		fprintf(stderr,"Use option -h for more information.\n");
+		exit(1);
+	}
+
+	ESPSerial serial;
+
+	if ( !serial.open(opt_device,opt_baudrate) ) {
+		fprintf(stderr,"%s: Opening serial device %s for r/w\n",
+			strerror(errno),
+			opt_device);
+		exit(3);
+	}
+
+	if ( opt_probe ) {
+		unsigned long t0 = ESPSerial::millis(0);
+
+		if ( !serial.probe_baud(true) ) {
+			fprintf(stderr,"No response from %s at any baud rate\n",opt_device);
+			exit(3);
+		}
+		if ( opt_verbose )
+			printf("Module at %d baud (probed in %lu ms)\n",
+				serial.get_baudrate(),ESPSerial::millis(0) - t0);
+	}
+
+	ESP8266 esp(ESPSerial::writeb,ESPSerial::readb,ESPSerial::rpoll,ESPSerial::idle,&serial);
+
+	if ( !esp.start() ) {
+		fprintf(stderr,"Unable to start ESP8266\n");
+		exit(3);
+	}
+
+	Co co(esp);
+
+	for ( int x=optind; x<argc; ++x )
+		fetch(co,argv[x]);
+
+	co.run();
+
+	if ( co.get_drops() > 0 )
+		printf("%lu bytes dropped (receive buffers full)\n",co.get_drops());
+
+	if ( opt_verbose )
+		printf("Serial: %lu bytes in %lu reads, %lu bytes written\n",
+			serial.get_rx_bytes(),serial.get_rx_reads(),serial.get_tx_bytes());
+
+	serial.close();
+	return 0;
+}
+
+// End cofetch.cpp
@@ -10,16 +10,20 @@
 #define N_CONNECTION	5
 #endif
 
+#include "espsync.hpp"
+#include "espqueue.hpp"
+
 #ifdef USING_RTOS
-extern "C" {
-	void yield();
-}
-#define YIELD	yield
+#define YIELD	ESPEvents::relax
 #else
 #define YIELD	receive
 #endif
 
-class ESP8266 {
+//////////////////////////////////////////////////////////////////////
+// Types and tables shared by all ESP8266T<> instantiations
+//////////////////////////////////////////////////////////////////////
+
+class ESP8266Base {
 public:
 	enum AP_Ecn {
 		Open = 0,
@@ -29,21 +33,60 @@ public:
 		Ecn_Undefined
 	};	
 
+	enum UartFlow {			// AT+UART_CUR flow control
+		FlowNone = 0,			// Disabled
+		FlowRts = 1,			// Module asserts RTS
+		FlowCts = 2,			// Module obeys CTS
+		FlowRtsCts = 3			// Both (the host sets CRTSCTS)
+	};
+
 	enum IpGwMask {		// IP Info Types
 		IP_Addr=10,	// +CIPAP:ip:"192.168.4.1"
 		Gateway,	// +CIPAP:gateway:"192.168.4.1"
 		NetMask		// +CIPAP:netmask:"255.255.255.0"
 	};
 
-	// I/O Callbacks:
-	typedef void (*idle_func_t)();			// Idle callback
-	typedef void (*write_func_t)(char b);		// Writes a byte
-	typedef char (*read_func_t)();			// Returns read byte
-	typedef bool (*poll_func_t)();			// Returns true if data to be read
+	struct ApInfo {			// Access point (AT+CWLAP)
+		AP_Ecn	ecn;			// Encryption (Ecn_Undefined if other)
+		char	ssid[33];		// SSID (up to 32 chars)
+		char	mac[18];		// BSSID "c0:ff:d4:95:80:04"
+		short	rssi;			// Signal strength (dBm)
+		short	channel;		// Channel, else -1
+	};
 
-	// User Callbacks:
-	typedef void (*recv_func_t)(int sock,int ch);		// Received data (1 byte)
-	typedef void (*accept_t)(int sock);			// Accepted socket
+	// I/O Callbacks (user is the pointer registered with the instance):
+	typedef void (*idle_func_t)(void *user);		// Idle callback
+	typedef void (*write_func_t)(char b,void *user);	// Writes a byte
+	typedef char (*read_func_t)(void *user);		// Returns read byte
+	typedef bool (*poll_func_t)(void *user);		// Returns true if data to be read
+	typedef unsigned long (*clock_func_t)(void *user);	// Returns milliseconds (any epoch)
+	typedef void (*writebuf_func_t)(const char *data,int bytes,void *user); // Writes bytes (one system call)
+
+	// User Callbacks (user is the pointer registered with the callback):
+	typedef void (*recv_func_t)(int sock,int ch,void *user);		// Received data (1 byte)
+	typedef void (*accept_t)(int sock,void *user);				// Accepted socket
+	typedef void (*capture_t)(int sock,bool tx,int ch,void *user);	// Captured payload byte (ch=-1 ends segment)
+	typedef void (*scan_t)(const ApInfo& ap,void *user);			// Scanned access point
+	typedef void (*notify_t)(int sock,short events,void *user);	// Socket readiness changed (PollEvent bits)
+	typedef int (*produce_t)(int sock,void *user);			// Next byte to send (0..255), else -1
+
+	enum Event {			// ESPEvents bits set by receive()
+		EvReady = 0x0001,		// "ready" after reset
+		EvWifiConnected = 0x0002,	// WIFI CONNECTED
+		EvGotIp = 0x0004,		// WIFI GOT IP
+		EvOk = 0x0008,			// OK
+		EvFail = 0x0010,		// FAIL
+		EvError = 0x0020,		// ERROR
+		EvDnsFail = 0x0040,		// DNS Fail
+		EvClosed = 0x0080,		// n,CLOSED
+		EvSendReady = 0x0100,		// ">" (ready for send data)
+		EvSendOk = 0x0200,		// SEND OK
+		EvSendFail = 0x0400,		// SEND FAIL
+		EvQueued = 0x0800,		// Record queued for dispatch()
+		EvBusy = 0x1000,		// busy p... / busy s... (command not taken)
+		EvCancel = 0x2000,		// cancel() (ends waits)
+		EvResp = EvOk|EvFail|EvError|EvBusy	// Command completions
+	};
 
 	enum Error {
 		Ok = 0,				// Success
@@ -54,34 +97,277 @@ public:
 		Resource			// Resource limitation
 	};
 
-private:
+	const char *strerror(Error err) const;		// Return text for error code
+
+	typedef void (*connect_t)(int sock,Error err,void *user);	// Asynchronous connect completed (err Ok if connected)
 
+	enum PollEvent {		// PollFd events and revents
+		PollIn = 0x01,			// Buffered data to recv()
+		PollOut = 0x02,			// Connected, with no send pending
+		PollErr = 0x04,			// Asynchronous connect failed
+		PollHup = 0x08,			// Remote closed
+		PollNval = 0x10			// Socket not open
+	};
+
+	struct IoVec {			// writev() part (as struct iovec)
+		const char	*base;		// Data
+		int		len;		// Bytes
+	};
+
+	struct PollFd {			// poll() entry
+		int		sock;		// Socket to check
+		short		events;		// PollIn and/or PollOut
+		short		revents;	// Returned events
+	};
+
+	enum SockState {		// get_state()
+		SockClosed = 0,			// Not open
+		SockConnecting,			// Asynchronous connect in progress
+		SockOpen,			// Connected (TCP), or ready (UDP)
+		SockDisconnected,		// Remote closed (close() still required)
+		SockFailed			// Asynchronous connect failed (close() still required)
+	};
+
+	enum CmdFlags {			// Retry of a command (see set_retry())
+		CmdIdempotent = 0x01,		// Safe to repeat: also retry after FAIL/ERROR
+		CmdNoRetry = 0x02		// Never retry (the caller handles busy)
+	};
+
+	enum OpKind {			// Asynchronous operations (see submit())
+		OpCommand,			// Command + CR LF, then OK/FAIL/ERROR
+		OpConnect,			// Open a TCP/UDP socket (AT+CIPSTART)
+		OpSend,				// Write to a socket (AT+CIPSEND)
+		OpClose				// Close a socket (AT+CIPCLOSE)
+	};
+
+	struct AsyncOp;
+	typedef void (*op_done_t)(AsyncOp& op,void *user);	// Operation completed
+
+	struct AsyncOp {		// Asynchronous operation (caller owned, until done)
+		AsyncOp		*next;		// Submit queue link
+		OpKind		kind;
+		short		phase;		// Progress (set to 0 by submit())
+		short		tries;		// Busy answers to the current command (OpSend, OpConnect)
+		unsigned long	due;		// millis() when a busy AT+CIPSTART is retried
+		short		sock;		// Socket (OpConnect: -1 allocates)
+		const char	*str;		// Command, host or data
+		int		len;		// Port (OpConnect), or bytes (OpSend)
+		int		lport;		// Local UDP port (OpConnect), else -1
+		bool		udp;		// UDP socket (OpConnect)
+		recv_func_t	rx_cb;		// Receive callback (OpConnect)
+		void		*rx_user;	// User pointer for rx_cb
+		int		sent;		// Bytes sent so far (OpSend)
+		int		result;		// Socket, bytes sent or 1, else -1 (see error)
+		Error		error;		// Error, when result is -1
+		op_done_t	done;		// Completion callback, else nullptr
+		void		*user;		// User pointer for done
+	};
+
+protected:
 	struct s_bufs {
 		char	*buf;
 		int	bufsiz;
 	};
 
-	write_func_t	writeb;			// Called to write 1 byte to ESP
-	read_func_t	readb;			// Called to read 1 byte from ESP
-	poll_func_t	rpoll;			// Called to poll if data to read from ESP
-	idle_func_t	idle;			// Idle callback
+	struct s_call {			// Results of the command in progress
+		s_bufs	*bufs;			// Buffers for returned strings, else nullptr
+		short	nbufs;			// Number of bufs[]
+		int	value;			// Returned number (+CIPSTO: etc.)
+	};
+
+	struct s_rxstate {
+		const char	*pattern;
+		short		start;
+		short		stateno;
+	};
+
+	static const s_rxstate rxstate[];	// receive() pattern table
+};
+
+//////////////////////////////////////////////////////////////////////
+// Function pointer I/O policy (used by class ESP8266)
+//
+// An I/O policy supplies the seven inline methods below. MCU builds can
+// supply their own policy class, accessing the UART registers directly,
+// so that the compiler can inline the per byte paths of receive() and
+// write(). For example:
+//
+//	struct Usart1Io {
+//		inline void writeb(char b)	{ while ( !(USART1_SR & TXE) ); USART1_DR = b; }
+//		inline void writebuf(const char *data,int bytes) { while ( bytes-- > 0 ) writeb(*data++); }
+//		inline char readb()		{ while ( !(USART1_SR & RXNE) ); return USART1_DR; }
+//		inline bool rpoll()		{ return USART1_SR & RXNE; }
+//		inline void idle()		{ }
+//		inline unsigned long millis()	{ return systick_ms; }
+//		inline bool has_clock()		{ return true; }	// millis() counts
+//	};
+//
+//	static ESP8266T<2,Usart1Io> esp((Usart1Io()));
+//
+// Such instantiations must #include "esp8266_impl.hpp" in one module.
+//////////////////////////////////////////////////////////////////////
+
+class ESP8266FuncIo {
+	ESP8266Base::write_func_t	writeb_cb;	// Called to write 1 byte to ESP
+	ESP8266Base::read_func_t	readb_cb;	// Called to read 1 byte from ESP
+	ESP8266Base::poll_func_t	rpoll_cb;	// Called to poll if data to read from ESP
+	ESP8266Base::idle_func_t	idle_cb;	// Idle callback
+	ESP8266Base::clock_func_t	clock_cb;	// Millisecond clock, else nullptr
+	ESP8266Base::writebuf_func_t	writebuf_cb;	// Block write, else nullptr (writeb_cb per byte)
+	void				*user;		// Passed to the callbacks
+
+public:	ESP8266FuncIo(ESP8266Base::write_func_t writeb,ESP8266Base::read_func_t readb,ESP8266Base::poll_func_t rpoll,ESP8266Base::idle_func_t idle,void *user)
+		: writeb_cb(writeb), readb_cb(readb), rpoll_cb(rpoll), idle_cb(idle), clock_cb(0), writebuf_cb(0), user(user) {}
+
+	inline void writeb(char b)		{ writeb_cb(b,user); }
+	inline void writebuf(const char *data,int bytes) {
+		if ( writebuf_cb )
+			writebuf_cb(data,bytes,user);
+		else while ( bytes-- > 0 )
+			writeb_cb(*data++,user);
+	}
+	inline char readb()			{ return readb_cb(user); }
+	inline bool rpoll()			{ return rpoll_cb(user); }
+	inline void idle()			{ if ( idle_cb ) idle_cb(user); }
+	inline unsigned long millis()		{ return clock_cb ? clock_cb(user) : 0; }
+	inline bool has_clock()			{ return clock_cb != 0; }
+	inline void set_clock(ESP8266Base::clock_func_t clock) { clock_cb = clock; }
+	inline void set_writebuf(ESP8266Base::writebuf_func_t wbuf) { writebuf_cb = wbuf; }
+	inline void *get_user()			{ return user; }
+};
+
+//////////////////////////////////////////////////////////////////////
+// The ESP8266 class template: N is the number of connections the
+// device supports, and Io is the I/O policy class.
+//
+// With a blocking sync backend (espsync.hpp), the command methods are
+// thread safe: each holds a recursive command lock for its duration,
+// while receive() runs in the thread started by start_receiver().
+// Receive and accept callbacks run in that thread, and so must not
+// issue commands themselves. They run without the socket state lock
+// held, so they may take the application's own locks, and use the
+// non-command methods (accept(), recv(), get_peer()...).
+//
+// Given an ESPQueue (set_queue()), receive() only queues the received
+// data, closes and accepts, and the callbacks run later from
+// dispatch(), in the main loop or another thread. A slow callback then
+// no longer holds up parsing, and callbacks run from dispatch() may
+// issue commands. Records that do not fit are dropped and counted
+// (get_overflows()).
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+class ESP8266T : public ESP8266Base {
+	Io		io;			// I/O policy
 
 	accept_t	accept_cb;		// Accept callback
-	
+	void		*accept_arg;		// User pointer for accept_cb
+	capture_t	capture_cb;		// Traffic capture callback, else nullptr
+	void		*capture_arg;		// User pointer for capture_cb
+	notify_t	notify_cb;		// Readiness notification, else nullptr
+	void		*notify_arg;		// User pointer for notify_cb
+
 	Error		error;			// Last error encountered
 
 	struct s_state {
 		recv_func_t	rxcallback;	// Receive callback
+		void		*rxarg;		// User pointer for rxcallback
 		unsigned	open : 1;	// 1 if this socket is in use 
 		unsigned	connected : 1;	// 1 if this socket is connected
 		unsigned	disconnected : 1; // 1 if this socket has seen a disconnect
 		unsigned	udp : 1;	// This is a UDP socket
+		unsigned	connecting : 1;	// Asynchronous connect in progress
+		unsigned	failed : 1;	// Asynchronous connect failed (see connop.error)
+		unsigned long	raddr;		// Remote IPv4 address (when host was dotted quad), else 0
+		unsigned short	rport;		// Remote port
+		unsigned short	lport;		// Local port (UDP), else 0
+		connect_t	conncallback;	// Asynchronous connect callback, else nullptr
+		AsyncOp		connop;		// Asynchronous connect operation
+		ESPQueue	rxq;		// Received data, when no rxcallback (set_rx_buffers())
+		char		*cbuf;		// Coalescing buffer (set_coalesce()), else nullptr
+		unsigned short	csize;		// Size of cbuf
+		unsigned short	clen;		// Bytes held in cbuf
+		unsigned short	cdelay;		// Milliseconds bytes may be held
+		unsigned long	ct0;		// millis() when the first held byte was written
+		Error		cerror;		// Failed flush_due() send, for the next write()/flush()
+		unsigned char	prio;		// Transmit priority (set_priority()), 0 lowest
+	};
+
+	enum {				// Send pacing (set_pacing())
+		PaceMinRate = 512,		// Least paced rate (bytes/s)
+		PaceStep = 1024,		// Rate increase per clean segment (bytes/s)
+		PaceSample = 512,		// Least segment length judged by latency
+		PaceLatency = 10,		// SEND OK latency (ms) always tolerated
+		PaceHold = 50,			// Milliseconds to hold off after busy
+		PaceRetries = 8			// Attempts of a command answered busy
+	};
+
+	enum {
+		CmdMax = 128			// Longest command line kept for retry
+	};
+
+	struct s_retry {
+		int		attempts;	// Attempts per command (1: no retry)
+		unsigned long	backoff;	// Milliseconds before the first retry
+		unsigned long	max_backoff;	// Limit of the doubled backoff
+		unsigned long	retries;	// Commands written again
+		unsigned long	giveups;	// Commands failed after all attempts
+	};
+
+	struct s_pace {
+		bool		on;		// Pacing enabled
+		unsigned long	rate;		// Paced send rate (bytes/s), else 0 (unpaced)
+		unsigned long	est;		// Smoothed segment service rate (bytes/s)
+		unsigned long	base;		// Least SEND OK latency (us/byte), else 0
+		unsigned	samples;	// Latency samples since base was raised
+		unsigned long	t_cmd;		// millis() when AT+CIPSEND was written
+		unsigned long	t_sent;		// millis() when its data was written
+		unsigned long	t_due;		// millis() when the next AT+CIPSEND may go
+		unsigned long	busy;		// busy and SEND FAIL responses to sends
+		unsigned long	backoffs;	// Rate decreases
+	};
+
+	struct s_scan {			// AT+CWLAP in progress
+		ApInfo		*aps;		// Results table, else nullptr
+		int		max;		// Size of aps[]
+		int		count;		// APs found
+		scan_t		cb;		// Callback, else nullptr
+		void		*user;		// User pointer for cb
 	};
 
 	char		*version;		// Version info, else nullptr
-	s_bufs		*bufsp;			// Temp ptr for collecting info
+	s_call		*callp;			// Result slot of the command in progress, else nullptr (statelock)
+	s_scan		*scanp;			// Scan in progress, else nullptr
+	struct s_join {			// Pinned join (ap_join())
+		char		ssid[33];	// SSID of bssid
+		char		bssid[18];	// AP last joined (get_ap_ssid()), else ""
+		bool		fast;		// Last join pinned bssid
+		unsigned long	ms;		// Last join latency (ms)
+	}		join;
+	ApInfo		*scache;		// Scan cache table, else nullptr
+	int		scache_size;		// Size of scache[]
+	int		scache_n;		// APs in scache[], else -1 (no scan)
+	unsigned long	scache_t;		// millis() when the cached scan ended
+
+	s_state		state[N];		// Sockets state
+
+	enum QRecord {			// ESPQueue record types (type,sock,len lo,len hi,data..)
+		QData = 'D',			// Received TCP data
+		QDatagram = 'U',		// Received UDP datagram (data, then end)
+		QClosed = 'C',			// Remote closed socket
+		QAccept = 'A'			// Accepted server socket
+	};
 
-	s_state		state[N_CONNECTION];	// Sockets state
+	ESPQueue	*queue;			// Callback event queue, else nullptr (callbacks run inline)
+
+	AsyncOp		*ophead;		// Submitted operations, oldest first
+	AsyncOp		*optail;		// Last submitted operation
+	int		lastsock;		// Socket last scheduled (round robin), N for none
+	s_pace		pace;			// Send pacing state
+	s_retry		retry;			// Command retry policy (set_retry())
+	char		cmdline[CmdMax];	// Last command line written (for retry)
+	short		cmdlen;			// Its length (CmdMax + 1 if too long)
+	bool		cmddone;		// It ended with LF (next byte starts anew)
 
 	short		first;			// First char after LF
 	short		ipd_id;			// Session ID
@@ -89,38 +375,167 @@ private:
 	short		resp_id;		// Response id in 0,CONNECT
 	short		s0;			// RX State
 	short		ss;			// RX Substate
+	bool		ipd_check;		// Next byte ends a +IPD payload
+	bool		line_bad;		// Garbage seen in this line
+	unsigned long	ipd_errors;		// +IPD payloads followed by neither CR LF nor a message
+	unsigned long	line_errors;		// Lines with non-printable bytes
+	unsigned long	flow_baud;		// Baud rate for AT+UART_CUR in start(), else 0
+	UartFlow	flow;			// Its flow control
 	short		channel;		// AP channel (CWJAP), when known (else -1)
 	short		strength;		// Strength (CWJAP), when known (else -1)
 
-	unsigned	ready : 1;		// Got "ready" after Reset
-	unsigned	wifi_connected : 1;	// WiFi connected
-	unsigned	wifi_got_ip : 1;	// WiFi has got IP
-	unsigned	resp_ok : 1;		// When OK
-	unsigned	resp_fail : 1;		// When FAIL
-	unsigned	resp_connected : 1;	// When session CONNECTED
-	unsigned	resp_closed : 1;	// When remote closed connection
-	unsigned	resp_dnsfail : 1;	// When DNS Fail
-	unsigned	resp_error : 1;		// When ERROR
-	unsigned	send_ready : 1;		// When ready to accept send data
-	unsigned	send_ok : 1;		// After successful SEND
-	unsigned	send_fail : 1;		// After failed SEND
+	ESPEvents	events;			// Event bits (see enum Event)
+	ESPLock		cmdlock;		// Serialises commands (thread safe mode)
+	ESPLock		statelock;		// Guards state[] (thread safe mode)
+	volatile bool	cancelled;		// cancel(): waits end, commands fail
+#ifdef ESP_SYNC_BLOCKING
+	ESPThread	rxthread;		// Receiver thread, when started
+	volatile bool	rxstop;			// Tells rxthread to return
+	static void receiver(void *arg);	// Receiver thread body
+#endif
+
+	// A command in progress: holds cmdlock and directs the parsed
+	// results into the caller's slot, until destroyed.
+	class CmdLock {
+		ESP8266T&	esp;
+		s_call		*prev;		// Outer call (nested commands)
+		s_call		slot;
+
+	public:	CmdLock(ESP8266T& esp,s_bufs *bufs=0,int nbufs=0) : esp(esp) {
+			esp.cmdlock.lock();
+			slot.bufs = bufs;
+			slot.nbufs = nbufs;
+			slot.value = 0;
+			ESPGuard guard(esp.statelock);	// callp is read by receive()
+			prev = esp.callp;
+			esp.callp = &slot;
+		}
+		~CmdLock() {
+			{
+				ESPGuard guard(esp.statelock);
+				esp.callp = prev;
+			}
+			esp.cmdlock.unlock();
+		}
+		inline int value() const	{ return slot.value; }
+	};
+
+	struct PartSource {			// send_segments() bytes from writev()
+		const IoVec	*parts;
+		int		x;		// Part being sent
+		int		off;		// Offset within it
+		inline int next() {
+			while ( off >= parts[x].len ) {
+				++x;
+				off = 0;
+			}
+			return (unsigned char)parts[x].base[off++];
+		}
+		inline int span(const char *&data,int max) {	// Contiguous bytes at data
+			while ( off >= parts[x].len ) {
+				++x;
+				off = 0;
+			}
+			int n = parts[x].len - off;
+			if ( n > max )
+				n = max;
+			data = parts[x].base + off;
+			off += n;
+			return n;
+		}
+	};
+
+	struct ProducerSource {			// send_segments() bytes from write_stream()
+		int		sock;
+		produce_t	prod_cb;
+		void		*user;
+		bool		ended;		// prod_cb returned -1
+		inline int next() {
+			int ch = ended ? -1 : prod_cb(sock,user);
+			if ( ch < 0 )
+				ended = true;
+			return ch;
+		}
+		inline int span(const char *&data,int max) { return 0; }	// Byte at a time only
+	};
+
+	inline void writeb(char b) {		// Write a command byte (recorded for retry)
+		if ( cmddone ) {
+			cmdlen = 0;
+			cmddone = false;
+		}
+		if ( cmdlen <= CmdMax ) {
+			if ( cmdlen < CmdMax )
+				cmdline[cmdlen] = b;
+			++cmdlen;
+		}
+		if ( b == '\n' )
+			cmddone = true;
+		io.writeb(b);
+	}
+	inline void writebuf(const char *data,int bytes) { io.writebuf(data,bytes); }
+	inline char readb()			{ return io.readb(); }
+	inline bool rpoll()			{ return io.rpoll(); }
+	inline void idle()			{ io.idle(); }
 
 	void waitlf();				// Read bytes until LF
+	unsigned await(unsigned mask);		// Wait for any of the event bits in mask
 	s_state *lookup(int sock);		// Lookup socket, else nullptr
-	bool waitokfail();			// Wait for OK or FAIL (or ERROR)
+	bool waitokfail(unsigned flags=0);	// Wait for OK or FAIL (or ERROR), retrying per CmdFlags
 	char read_id();				// Read in an unsigned integer
 	char read_buf(int bufx,char stop);	// Read into bufx until stop char
+	inline void set_value(int v)		{ ESPGuard guard(statelock); if ( callp ) callp->value = v; }	// Into the call in progress
 	char skip_until(char b,char stop);	// Skip until stop charactor (or \r)
-
-	int socket(const char *socktype,const char *host,int port,recv_func_t rx_cb,int local_port=-1);
-
-public:	ESP8266(write_func_t writeb,read_func_t readb,poll_func_t rpoll,idle_func_t idle);	// Non RTOS constructor
-	~ESP8266();
+	char read_ap(ApInfo& ap);		// Read the rest of a +CWLAP:( line
+	bool msg_start(char b);			// b may follow an +IPD payload
+	void scan_found(const ApInfo& ap);	// Deliver a scanned AP
+	int scan(ApInfo *aps,int max,scan_t cb,void *user,unsigned long max_age);
+	bool join_cmd(const char *ap,const char *passwd,const char *bssid); // AT+CWJAP=
+	bool enqueue(QRecord type,int sock,int len); // Start a queue record (put len bytes, then commit)
+	bool step(AsyncOp& op);			// Progress op, returning true when done
+	void schedule();			// Move the operation to run next to ophead
+	inline bool at_boundary(const AsyncOp& op) const { return op.phase == 0 || (op.kind == OpSend && op.phase == 1); } // May yield to another op
+	bool send_pending(int sock);		// True if an OpSend for sock is queued
+	short poll_events(int sock);		// Current PollEvent bits for sock
+
+	inline bool pace_due() { return !pace.on || !pace.rate || long(io.millis() - pace.t_due) >= 0; }
+	inline void pace_sent()			{ pace.t_sent = io.millis(); }
+	void pace_cmd(int bytes);		// AT+CIPSEND written for bytes
+	void pace_ok(int bytes);		// SEND OK received for bytes
+	void pace_backoff(bool busy);		// Congestion seen: cut the rate
+
+	inline void notify_sock(int sock,short events) { if ( notify_cb ) notify_cb(sock,events,notify_arg); }
+
+	int alloc_socket(bool udp,const char *host,int port,int local_port); // Allocate state[], else -1
+	void cipstart(int sock,bool udp,const char *host,int port,int local_port); // Write AT+CIPSTART
+	void cipsend(int sock,int bytes,const char *udp_address=0); // Write AT+CIPSEND
+	template <class Src>
+	int send_segments(int sock,int bytes,Src& src,const char *udp_address); // Send bytes from src (writev(), write_stream())
+
+	int socket(const char *socktype,const char *host,int port,recv_func_t rx_cb,void *rx_user,int local_port=-1);
+	int socket_async(bool udp,const char *host,int port,recv_func_t rx_cb,void *rx_user,int local_port,connect_t conn_cb);
+	static void connected(AsyncOp& op,void *user);	// Asynchronous connect completed
+
+public:	enum { Connections = N };
+
+	ESP8266T(const Io& io);
+	~ESP8266T();
 	void clear(bool notify);		// Clear like the constructor (after reset)
 
+	inline Io& get_io()			{ return io; }
+
 	inline Error get_error() const		{ return error; }
 	inline const char *strerror() const	{ return strerror(error); }
-	const char *strerror(Error err) const;		// Return text for error code
+	using ESP8266Base::strerror;
+
+	inline void set_capture(capture_t cap_cb,void *user=0) { capture_cb = cap_cb; capture_arg = user; }
+	// set_notify() registers a hook called (from receive() or advance())
+	// when a socket gains data (PollIn), is accepted or connects
+	// (PollOut), is closed by the remote (PollHup) or fails to connect
+	// (PollErr). It must not block: it is meant to wake an event loop
+	// (see espfd.hpp), which then uses poll(...,0) and recv().
+	inline void set_notify(notify_t note_cb,void *user=0) { notify_cb = note_cb; notify_arg = user; }
+	bool get_peer(int sock,unsigned long& ipaddr,int& port,int& local_port,bool& udp);
 
 	inline int get_softap_channel() const	{ return channel; }
 	inline int get_softap_strength() const	{ return strength; }
@@ -128,11 +543,43 @@ public:	ESP8266(write_func_t writeb,read_func_t readb,poll_func_t rpoll,idle_fun
 	bool reset();					// Reset the ESP device (and optionally await wifi connect)
 	bool wait_reset();				// Wait for "ready" message after hardware reset
 	bool start();					// Set operational parameters (required if no reset)
+
+	// cancel() makes a command blocked in another thread (awaiting a
+	// module that stopped answering) fail at once, and every command
+	// after it, until cancel(false). It is meant for a watchdog, so
+	// that the blocked thread returns and can be joined.
+	void cancel(bool on=true);
+	inline bool is_cancelled() const	{ return cancelled; }
+
+	// Flow control: the host sets CRTSCTS, but the module only uses
+	// RTS/CTS once told to with AT+UART_CUR, which also restates its
+	// baud rate (8N1). set_flow_control() has start() (and so reset())
+	// send it; set_uart() sends it now. Overrun signs in the received
+	// stream are counted since the last "ready": +IPD payloads followed
+	// by neither CR LF nor a new message (bytes were lost, so reading
+	// the length overran) and lines holding non-printable bytes.
+	inline void set_flow_control(unsigned long baudrate,UartFlow fc=FlowRtsCts) { flow_baud = baudrate; flow = fc; }
+	bool set_uart(unsigned long baudrate,UartFlow fc);	// AT+UART_CUR=baudrate,8,1,0,fc
+	inline unsigned long get_ipd_errors() const	{ return ipd_errors; }
+	inline unsigned long get_line_errors() const	{ return line_errors; }
 	void wait_wifi(bool got_ip);			// Wait for "WIFI CONNECTED" (optionally WIFI GOT IP)
 	bool is_wifi(bool got_ip);			// Return true if we have AP (optionally and IP)
 
 	bool query_softap(char *ssid,int ssidsiz,char *pw,int pwsiz,int& ch,AP_Ecn& ecn);
 
+	// Access point scan (AT+CWLAP takes 2-3 seconds): the APs found go
+	// into aps[] (up to max), or to the callback as each is received
+	// (in the receive context: it must not issue commands). Returns the
+	// number found (may exceed max), else -1. With a cache table set,
+	// each scan is also kept there, and max_age > 0 returns the cached
+	// scan instead if it ended within max_age ms (without a clock the
+	// age is unknown, so it always rescans).
+	inline int scan_aps(ApInfo *aps,int max,unsigned long max_age=0) { return scan(aps,max,0,0,max_age); }
+	inline int scan_aps(scan_t cb,void *user=0,unsigned long max_age=0) { return scan(0,0,cb,user,max_age); }
+	void set_scan_cache(ApInfo *cache,int size);	// Caller's table (nullptr: no cache)
+	unsigned long get_scan_age();			// ms since the cached scan, else ~0ul (also with no clock)
+	inline int get_scan_cache(const ApInfo *&aps) const { aps = scache; return scache_n; } // Cached APs, else -1
+
 	bool get_version(char *buf,int bufsiz);		// Return ESP version
 
 	void crlf();					// Write CR LF to ESP device
@@ -141,7 +588,16 @@ public:	ESP8266(write_func_t writeb,read_func_t readb,poll_func_t rpoll,idle_fun
 
 	bool dhcp(bool on);				// Enable/disable DHCP
 
-	bool ap_join(const char *ap,const char *passwd); // Join Access Point
+	// Pinned join: get_ap_ssid() (and so is_wifi()) remembers the
+	// BSSID of the AP joined. ap_join() with fast restricts a join of
+	// the same SSID to that BSSID, and falls back to a join of any AP
+	// if that fails. The module still scans for it (no channel can be
+	// given). The latency (ms, needs a clock) is kept for either path.
+	bool ap_join(const char *ap,const char *passwd,bool fast=false); // Join Access Point
+	void set_join_bssid(const char *ssid,const char *bssid); // Pin an AP (e.g. from scan_aps()), nullptr forgets
+	inline const char *get_join_bssid() const { return join.bssid; }	// Remembered BSSID, else ""
+	inline unsigned long get_join_ms() const { return join.ms; }		// Last ap_join() latency
+	inline bool is_join_fast() const	{ return join.fast; }		// Last ap_join() used the BSSID
 
 	bool get_ap_ssid(char *ssid,int ssid_size,char *mac,int mac_size,int& chan,int& db);
 	bool get_ap_info(char *ip,int ipsiz,char *gw,int gwsiz,char *nm,int nmsiz);
@@ -159,18 +615,103 @@ public:	ESP8266(write_func_t writeb,read_func_t readb,poll_func_t rpoll,idle_fun
 	int get_timeout();				// Get station timeout
 	bool set_timeout(int seconds);			// Set station timeout
 
-	bool listen(int port,accept_t accp_cb);		// Station listen port & accept callback
-	void accept(int socket,recv_func_t recv_cb);	// Accept a connection, set recv callback
+	bool listen(int port,accept_t accp_cb,void *user=0);		// Station listen port & accept callback
+	inline void set_accept(accept_t accp_cb,void *user=0) { accept_cb = accp_cb; accept_arg = user; } // For AT+CIPSERVER as an OpCommand
+	void accept(int socket,recv_func_t recv_cb,void *user=0);	// Accept a connection, set recv callback
 	bool unlisten();				// Close station listening port
 
-	int tcp_connect(const char *host,int port,recv_func_t rx_cb);	// Connect to TCP destination with recv callback
-	int udp_socket(const char *host,int port,recv_func_t rx_cb,int local_port=-1);	// Create UDP socket to send to host at port, with recv callback
+	int tcp_connect(const char *host,int port,recv_func_t rx_cb,void *user=0);	// Connect to TCP destination with recv callback
+	int udp_socket(const char *host,int port,recv_func_t rx_cb,int local_port=-1,void *user=0);	// Create UDP socket to send to host at port, with recv callback
+
+	// Asynchronous variants: allocate and return the socket at once.
+	// The connect completes from advance(), calling conn_cb (if any);
+	// until then get_state() returns SockConnecting. Keep host valid
+	// until completion. A failed socket must still be closed. A busy
+	// answer is retried per set_retry(), else the connect fails.
+	int tcp_connect_async(const char *host,int port,recv_func_t rx_cb,void *user=0,connect_t conn_cb=0);
+	int udp_socket_async(const char *host,int port,recv_func_t rx_cb,int local_port=-1,void *user=0,connect_t conn_cb=0);
+	SockState get_state(int sock);			// Socket state (pollable)
+	Error get_sock_error(int sock);			// Error of a SockFailed socket
+
+	// Readiness: sockets without a receive callback keep their data in
+	// a ring (carved from set_rx_buffers()) for recv(). poll() reports
+	// PollIn/PollOut/PollErr/PollHup/PollNval for each PollFd, waiting
+	// up to timeout_ms (-1 forever) while it receives and progresses
+	// asynchronous operations. Timeouts need Io::millis().
+	void set_rx_buffers(char *buf,unsigned size);	// Rings for all N sockets (size/N each)
+	int poll(PollFd *fds,int nfds,long timeout_ms);	// Ready count (0 on timeout)
+	int recv(int sock,char *buf,int bytes);		// Buffered bytes read (0 if none), else -1
+	unsigned long get_rx_overflows(int sock);	// Bytes dropped when sock's ring was full
+
 	int write(int sock,const char *data,int bytes,const char *udp_address=0); // Write to TCP/UDP connection (optionally to a different UDP address)
+	int writev(int sock,const IoVec *parts,int n,const char *udp_address=0); // Write parts as one (gathered into each AT+CIPSEND)
+	// write_stream() sends bytes without a buffer: prod_cb is called for
+	// each byte as its AT+CIPSEND segment is written, after the '>'
+	// prompt. If prod_cb returns -1 early, the segment is padded with
+	// zero bytes and -1 is returned (error Invalid).
+	int write_stream(int sock,int bytes,produce_t prod_cb,void *user=0,const char *udp_address=0); // Write bytes pulled from prod_cb
+
+	// Coalescing (TCP): write() holds small writes in the buffer given
+	// to set_coalesce(), and sends them as one AT+CIPSEND when it would
+	// overflow, once delay_ms has passed since the first held byte
+	// (checked by write(), poll() and flush_due(), using Io::millis()),
+	// or on flush(sock) and close(). write() then returns the bytes it
+	// accepted (a socket not connected fails at once); when flush_due()
+	// fails to send them, the next write() or flush() returns -1.
+	bool set_coalesce(int sock,char *buf,int size,int delay_ms=20); // Hold small writes (buf nullptr: off)
+	int flush(int sock);				// Send held bytes: count sent, else -1
+	int flush_due();				// Flush sockets whose delay passed (returns count)
 	bool close(int sock);						// Close TCP connection
 	void close_all();
 
 	void receive();					// Receiving state machine
 
+	// Queued callbacks: receive() queues received data, closes and
+	// accepts, and dispatch() later invokes the callbacks for them
+	inline void set_queue(ESPQueue *q)		{ queue = q; }
+	unsigned dispatch();				// Run callbacks for queued records (returns count)
+	inline unsigned long get_overflows() const	{ return queue ? queue->get_overflows() : 0; }
+
+#ifdef ESP_SYNC_BLOCKING
+	bool start_receiver();				// Run receive() in its own thread
+	void stop_receiver();				// Stop and join the receiver thread
+	inline void wait_queued()			{ events.wait(EvQueued); events.clear(EvQueued); }
+#endif
+
+	// Asynchronous operations: submit() queues op and returns at once.
+	// Each call to advance() (after receive()) issues or progresses
+	// an operation without waiting, and calls op.done when it
+	// completes. Do not issue blocking commands while any are pending.
+	//
+	// Operations on one socket run in order, but between operations,
+	// and between the AT+CIPSEND segments of an OpSend, the sockets
+	// take turns: the highest set_priority() first, then round robin.
+	// So a bulk send no longer delays a control socket's sends by more
+	// than one segment. OpCommand operations keep their place.
+	//
+	// Some steps wait on the clock rather than on input: a paced send
+	// slot, a busy connect's backoff, and held coalesced bytes. An
+	// event loop that sleeps until input must wake by next_due() and
+	// call advance() (then flush_due(), if none are pending) even when
+	// the module stays quiet.
+	void submit(AsyncOp& op);			// Queue an asynchronous operation
+	bool advance();					// Progress operations (true while any pending)
+	long next_due();				// ms until a timed step is due (0 now), else -1
+	bool set_priority(int sock,int prio);		// Transmit priority 0 (default) .. 255
+
+	// Pacing: the module answers "busy s..." or SEND FAIL, or drops
+	// data, when segments come faster than it drains them to WiFi. A
+	// send answered busy is retried (up to PaceRetries times) in any
+	// case. With set_pacing(true), each busy or SEND FAIL also halves
+	// the send rate, a SEND OK latency of twice the least seen (per
+	// byte) cuts it by a quarter, and each clean SEND OK raises it by
+	// PaceStep, until it is no longer the limit. Pacing needs a
+	// clock: without one, set_pacing(true) returns false (pacing off).
+	bool set_pacing(bool on);			// Adaptive send rate on/off
+	inline unsigned long get_send_rate() const	{ return pace.rate; }	// Bytes/s, 0 when unpaced
+	inline unsigned long get_busy_count() const	{ return pace.busy; }
+	inline unsigned long get_backoffs() const	{ return pace.backoffs; }
+
 	//////////////////////////////////////////////////////////////
 	// Intermediate API
 	//////////////////////////////////////////////////////////////
@@ -184,27 +725,47 @@ public:	ESP8266(write_func_t writeb,read_func_t readb,poll_func_t rpoll,idle_fun
 	// The "manual" API
 	//////////////////////////////////////////////////////////////
 
-	bool commandok(const char *cmd);		// Issue command + CR LF and wait for OK/FAIL/ERROR
-
-	inline void clear_flag_ready()			{ ready = 0; }
-	inline void clear_flag_wifi_connected()		{ wifi_connected = 0; }
-	inline void clear_flag_got_ip()			{ wifi_got_ip = 0; }
-	inline void clear_flag_ok()			{ resp_ok = 0; }
-	inline void clear_flag_fail()			{ resp_fail = 0; }
-	inline void clear_flag_dnsfail()		{ resp_dnsfail = 0; }
-	inline void clear_flag_error()			{ resp_error = 0; }
-
-	inline bool get_flag_ready() const		{ return ready; }
-	inline bool get_flag_wifi_connected() const	{ return wifi_connected; }
-	inline bool get_flag_got_ip() const		{ return wifi_got_ip; }
-	inline bool get_flag_ok() const			{ return resp_ok; }
-	inline bool get_flag_fail() const		{ return resp_fail; }
-	inline bool get_flag_dnsfail() const		{ return resp_dnsfail; }
-	inline bool get_flag_error() const		{ return resp_error; }
+	bool commandok(const char *cmd,unsigned flags=0); // Issue command + CR LF and wait for OK/FAIL/ERROR (CmdFlags)
+
+	// Retry: a command answered "busy p..." or "busy s..." was not
+	// taken, and is written again, for up to attempts in all, after
+	// backoff_ms (doubled after each retry, up to max_backoff_ms).
+	// Idempotent commands (queries and setters, or commandok() with
+	// CmdIdempotent) are also retried after FAIL or ERROR. The default
+	// of one attempt disables retry. Without a clock, the backoff is
+	// skipped and the command is written again at once.
+	void set_retry(int attempts,unsigned long backoff_ms=20,unsigned long max_backoff_ms=1000);
+	inline unsigned long get_retries() const	{ return retry.retries; }
+	inline unsigned long get_giveups() const	{ return retry.giveups; }
+
+	inline void clear_flag_ready()			{ events.clear(EvReady); }
+	inline void clear_flag_wifi_connected()		{ events.clear(EvWifiConnected); }
+	inline void clear_flag_got_ip()			{ events.clear(EvGotIp); }
+	inline void clear_flag_ok()			{ events.clear(EvOk); }
+	inline void clear_flag_fail()			{ events.clear(EvFail); }
+	inline void clear_flag_dnsfail()		{ events.clear(EvDnsFail); }
+	inline void clear_flag_error()			{ events.clear(EvError); }
+
+	inline bool get_flag_ready() const		{ return events.get() & EvReady; }
+	inline bool get_flag_wifi_connected() const	{ return events.get() & EvWifiConnected; }
+	inline bool get_flag_got_ip() const		{ return events.get() & EvGotIp; }
+	inline bool get_flag_ok() const			{ return events.get() & EvOk; }
+	inline bool get_flag_fail() const		{ return events.get() & EvFail; }
+	inline bool get_flag_dnsfail() const		{ return events.get() & EvDnsFail; }
+	inline bool get_flag_error() const		{ return events.get() & EvError; }
+};
+
+//////////////////////////////////////////////////////////////////////
+// The function pointer based ESP8266 class, with N_CONNECTION sockets
+//////////////////////////////////////////////////////////////////////
+
+class ESP8266 : public ESP8266T<N_CONNECTION,ESP8266FuncIo> {
+public:	ESP8266(write_func_t writeb,read_func_t readb,poll_func_t rpoll,idle_func_t idle,void *user=0);	// Non RTOS constructor
 };
 
 const char *int2str(int v,char *buf,int bufsiz);
 int str2int(const char *s);
+unsigned long str2ip(const char *s);
 
 #endif // ESP8266_HPP
 
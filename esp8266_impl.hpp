@@ -0,0 +1,2997 @@
+///////////////////////////////////////////////////////////////////////
+// esp8266_impl.hpp -- Implementation of the ESP8266T<> Class Template
+// Date: Mon Oct 26 20:20:22 2015  (C) Warren W. Gay VE3WWG 
+///////////////////////////////////////////////////////////////////////
+//
+// Include this file (after esp8266.hpp) in exactly one module for each
+// ESP8266T<N,Io> instantiation that you declare. The function pointer
+// based class ESP8266 is instantiated by esp8266.cpp.
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef ESP8266_IMPL_HPP
+#define ESP8266_IMPL_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+
+#include "esp8266.hpp"
+
+#define DBG 	0
+
+#if DBG
+#define RX(x) printf("RX(%c)\n",x)
+#define CMD(s) puts(s)
+#define CMDX(s) fputs(s,stdout);
+#define CMDC(c) putchar(c)
+#else
+#define RX(x)
+#define CMD(x)
+#define CMDX(s)
+#define CMDC(c)
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// Constructor
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+ESP8266T<N,Io>::ESP8266T(const Io& io) : io(io), capture_cb(0), capture_arg(0), notify_cb(0), notify_arg(0), callp(0), scanp(0), scache(0), scache_size(0), scache_n(-1), scache_t(0), queue(0), ophead(0), optail(0), lastsock(N) {
+	memset(&pace,0,sizeof pace);
+	memset(&retry,0,sizeof retry);
+	memset(&join,0,sizeof join);
+	flow_baud = 0;
+	flow = FlowNone;
+	retry.attempts = 1;
+	cmdlen = 0;
+	cmddone = true;
+	cancelled = false;
+	clear(false);
+}
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::clear(bool notify) {
+	recv_func_t rx_cb[N];			// Closure callbacks, made unlocked
+	void *rx_arg[N];
+	accept_t acc_cb = 0;
+	void *acc_arg = 0;
+
+	{
+		ESPGuard guard(statelock);
+
+		if ( notify ) {
+			acc_cb = accept_cb;		// Notify server of closure
+			acc_arg = accept_arg;
+		}
+
+		for ( int sock=0; sock<N; ++sock ) {
+			s_state& s = state[sock];
+
+			rx_cb[sock] = notify && s.open && !s.disconnected ? s.rxcallback : 0;
+			rx_arg[sock] = s.rxarg;		// Notify app of closure
+			s.open = 0;
+			s.connected = s.disconnected = 0;
+			s.connecting = s.failed = 0;
+			s.conncallback = 0;
+			s.rxq.reset();
+			s.cbuf = 0;
+			s.clen = 0;
+			s.cerror = Ok;
+			s.prio = 0;
+			s.rxcallback = 0;
+			s.rxarg = 0;
+			s.raddr = 0;
+			s.rport = s.lport = 0;
+		}
+
+		channel = -1;		// Unknown
+		strength = -1;
+
+		first = '\n';
+		s0 = ss = 0;
+		resp_id = ipd_id = ipd_len = 0;
+		ipd_check = line_bad = false;
+		ipd_errors = line_errors = 0;
+
+		events.clear(~0u);
+
+		version = 0;
+		error = Ok;
+
+		accept_cb = 0;
+		accept_arg = 0;
+	}
+
+	if ( acc_cb )
+		acc_cb(-1,acc_arg);
+	for ( int sock=0; sock<N; ++sock )
+		if ( rx_cb[sock] )
+			rx_cb[sock](sock,-1,rx_arg[sock]);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Destructor
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+ESP8266T<N,Io>::~ESP8266T() {
+}
+
+//////////////////////////////////////////////////////////////////////
+// Lookup a socket
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+typename ESP8266T<N,Io>::s_state *
+ESP8266T<N,Io>::lookup(int sock) {
+
+	if ( sock < 0 || sock >= N ) {
+		error = Invalid;
+		return 0;
+	}
+
+	return &state[sock];
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read an unsigned integer into this->resp_id, returning stop char
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+char
+ESP8266T<N,Io>::read_id() {
+	char b;
+
+	resp_id = 0;
+	while ( (b = readb()) >= '0' && b <= '9' )
+		resp_id = resp_id * 10 + (b & 0x0F);
+	return b;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read into selected buffer of the call in progress (else discard).
+// statelock keeps the caller's slot from going away meanwhile.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+char
+ESP8266T<N,Io>::read_buf(int bufx,char stop) {
+	ESPGuard guard(statelock);
+	s_bufs *bufp = callp && bufx < callp->nbufs ? &callp->bufs[bufx] : 0;
+	char *buf = bufp ? bufp->buf : 0;
+	int x = 0, maxlen = bufp ? bufp->bufsiz : 0;
+	char b;
+
+	while ( (b = readb()) != stop && b != '\r' ) {
+		if ( buf && x + 1 >= maxlen )
+			break;
+		if ( buf )
+			buf[x++] = b;
+	}
+	if ( buf )
+		buf[x] = 0;
+
+	return skip_until(b,stop);
+}	
+
+//////////////////////////////////////////////////////////////////////
+// Skip until stop char is read, else stop if CR is reached
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+char
+ESP8266T<N,Io>::skip_until(char b,char stop) {
+
+	do	{
+		if ( b == stop )
+			return b;
+		b = readb();
+	} while ( b != '\r' );
+	return b;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read the rest of an AP line (after "+CWLAP:("), returning stop char:
+// 3,"NETGEAR67",-57,"c0:ff:d4:95:80:04",11)
+// The SSID may hold commas, so it runs to the closing quote. Later
+// firmware appends more fields after the channel, which are skipped.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+char
+ESP8266T<N,Io>::read_ap(ApInfo& ap) {
+	unsigned x;
+	bool neg;
+	char b;
+
+	ap.ecn = Ecn_Undefined;
+	ap.ssid[0] = ap.mac[0] = 0;
+	ap.rssi = 0;
+	ap.channel = -1;
+
+	b = read_id();
+	if ( resp_id < Ecn_Undefined )
+		ap.ecn = AP_Ecn(resp_id);
+	if ( (b = skip_until(b,'"')) != '"' )
+		return b;
+	for ( x = 0; (b = readb()) != '"' && b != '\r'; )
+		if ( x + 1 < sizeof ap.ssid )
+			ap.ssid[x++] = b;
+	ap.ssid[x] = 0;
+	if ( (b = skip_until(b,',')) != ',' )
+		return b;
+
+	if ( (neg = (b = readb()) == '-') )
+		b = readb();
+	for ( x = 0; b >= '0' && b <= '9'; b = readb() )
+		x = x * 10 + (b & 0x0F);
+	ap.rssi = neg ? -short(x) : short(x);
+
+	if ( (b = skip_until(b,'"')) != '"' )
+		return b;
+	for ( x = 0; (b = readb()) != '"' && b != '\r'; )
+		if ( x + 1 < sizeof ap.mac )
+			ap.mac[x++] = b;
+	ap.mac[x] = 0;
+	if ( (b = skip_until(b,',')) != ',' )
+		return b;
+
+	b = read_id();
+	ap.channel = resp_id;
+	return skip_until(b,'\r');
+}
+
+//////////////////////////////////////////////////////////////////////
+// True if b may start what follows an +IPD payload: CR LF, a socket
+// message ("0,CLOSED") or the first character of a receive() pattern
+// (such as "+IPD,", "WIFI DISCONNECT", "SEND OK" or "busy s...")
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::msg_start(char b) {
+
+	if ( b == '\r' || (b >= '0' && b <= '9') )
+		return true;
+	for ( int s = 0; rxstate[s].pattern; ++s )
+		if ( rxstate[s].pattern[0] == b )
+			return true;
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Perform receive functions
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::receive() {
+	char b;
+
+	while ( rpoll() ) {
+		b = readb();
+#if DBG >= 3
+		printf("rx b='%c' %02X (first=%02X, s0=%d, ss=%d)\n",b,b,first,s0,ss);
+#endif
+		if ( ipd_check ) {		// +IPD payload: CR LF or a message follows
+			ipd_check = false;
+			if ( !msg_start(b) )
+				++ipd_errors;	// Overrun: bytes lost, length overran
+		}
+		if ( (b < ' ' || b > '~') && b != '\r' && b != '\n' && !line_bad ) {
+			line_bad = true;	// Garbage in this line (overrun or noise)
+			++line_errors;
+		}
+
+		if ( b == '\n' ) {
+			line_bad = false;
+			first = '\n';
+			s0 = ss = 0;
+			continue;
+		}
+
+		if ( first == '\n' ) {
+			first = b;
+			if ( first >= '0' && first <= '9' ) {
+				first = '9';
+				resp_id = 0;
+			} else if ( first == '>') {
+				events.set(EvSendReady);
+				first = 0;
+#if DBG >= 2
+				puts("))) SENDING>");
+#endif
+				continue;
+			}
+		} else if ( !first ) {
+			continue;
+		}
+		
+// printf("first=%04X, b='%c' %02X, s0=%d, ss=%d\n",first,b,b,s0,ss);
+
+		if ( first == '9' ) {
+			if ( b == ',' ) {
+				first = b;
+				s0 = ss = 0;
+			} else	{
+				resp_id = resp_id * 10 + ( b & 0x0F );
+				continue;
+			}
+		}
+
+		if ( !ss && first < 0x0100 ) {
+			// Locate matching first character
+			for ( s0 = 0; rxstate[s0].pattern && rxstate[s0].pattern[0] != first; ++s0 )
+				;
+			if ( !rxstate[s0].pattern ) {
+				first = 0;
+				continue;
+			}
+		}
+
+		if ( b == rxstate[s0].pattern[ss] ) {
+			if ( !rxstate[s0].pattern[++ss] ) {
+#if DBG >= 2
+				printf("STATE = 0x%04X (%s)\n",rxstate[s0].stateno,rxstate[s0].pattern);
+#endif
+				switch ( rxstate[s0].stateno ) {
+				case 0x0100:	// "+IPD,",
+					{
+						b = read_id();
+						ipd_id = resp_id;
+						b = read_id();
+						ipd_len = resp_id;
+						// Stops on b=':'
+						// Read session data
+#if DBG
+						printf("))) +IPD,%d,%d:\n",ipd_id,ipd_len);
+#endif
+						recv_func_t rx_cb = 0;
+						void *rx_arg = 0;
+						ESPQueue *rxq = 0;
+						bool udp = false, known = false, queued = false;
+
+						{
+							ESPGuard guard(statelock);
+							s_state *statep = lookup(ipd_id);
+
+							if ( statep ) {
+								rx_cb = statep->rxcallback;
+								rx_arg = statep->rxarg;
+								udp = statep->udp;
+								known = true;
+								if ( !rx_cb && statep->rxq.size() )
+									rxq = &statep->rxq;	// Buffer for recv()
+							}
+						}
+
+						if ( queue && known && !rxq )
+							queued = enqueue(udp ? QDatagram : QData,ipd_id,ipd_len);
+
+						while ( ipd_len > 0 ) {
+							b = readb();
+							--ipd_len;
+							if ( capture_cb )
+								capture_cb(ipd_id,false,b,capture_arg);
+							if ( rxq ) {
+								if ( rxq->reserve(1) ) {
+									rxq->put(b);
+									rxq->commit();
+								}
+							} else if ( queue ) {
+								if ( queued )
+									queue->put(b);
+							} else if ( rx_cb )
+								rx_cb(ipd_id,b,rx_arg);
+#if DBG
+							else	printf(" +IPD(%d,ch='%c' %02X) bytes remaining %d\n",ipd_id,b,b,ipd_len);
+#endif
+						}
+						if ( capture_cb )
+							capture_cb(ipd_id,false,-1,capture_arg);	// End of captured segment
+						if ( queued ) {
+							queue->commit();
+							events.set(EvQueued);
+						} else if ( !queue && udp && rx_cb ) // Is this a UDP socket?
+							rx_cb(ipd_id,-1,rx_arg);	// yes, send -1 to indicate end of datagram
+						if ( known )
+							notify_sock(ipd_id,PollIn);
+						first = '\n';
+						ipd_id = ipd_len = 0;
+						resp_id = 0;
+						s0 = ss = 0;
+						ipd_check = true;
+					}
+					continue;
+				case 0x0101:	// "+CWAUTOCONN:",
+					b = readb();
+					set_value(b == '0' ? 0 : 1);
+					break;
+				case 0x0111:	// +CWJAP:"NETGEAR67","c0:ff:d4:95:80:04",7,-66
+					events.set(EvWifiConnected);
+					b = read_buf(0,'"');
+					b = skip_until(0,'"');
+					b = read_buf(1,'"');
+					b = skip_until(b,',');
+					b = read_buf(2,',');
+					b = read_buf(3,'\r');
+					break;
+				case 0x0102:	// "+CIPAP:ip:\""
+					b = read_buf(0,'"');
+					if ( !(events.get() & EvGotIp) ) {
+						// Invoked by is_wifi(bool got_ip=true)
+						ESPGuard guard(statelock);
+
+						if ( callp && callp->nbufs > 0 && callp->bufs[0].buf
+						  && strcmp(callp->bufs[0].buf,"0.0.0.0") != 0 )
+							events.set(EvGotIp);
+					}
+					break;
+				case 0x0112:	// "+CIPAP:gateway:\""
+					b = read_buf(1,'"');
+					break;
+				case 0x0122:	// "+CIPAP:netmask:\""
+					b = read_buf(2,'"');
+					break;
+				case 0x0103:	// "+CIPAPMAC:\"",
+					b = read_buf(0,'"');
+					break;
+				case 0x0104:	// "+CIPSTA:ip:\"",
+					b = read_buf(0,'"');
+					break;
+				case 0x0114:	// "+CIPSTA:gateway:\"",
+					b = read_buf(1,'"');
+					break;
+				case 0x0124:	// "+CIPSTA:netmask:\"",
+					b = read_buf(2,'"');
+					break;
+				case 0x0134:	// +CWSAP:"AI-THINKER_FA205E","",11,0
+					b = read_buf(0,'"');
+					b = skip_until(b,',');
+					b = skip_until(b,'"');
+					b = read_buf(1,'"');
+					b = skip_until(b,',');
+					b = read_buf(2,',');
+					b = read_buf(3,'\r');
+					first = 0;
+					break;
+				case 0x0135:	// +CWLAP:(3,"NETGEAR67",-57,"c0:ff:d4:95:80:04",11)
+					{
+						ApInfo ap;
+
+						b = read_ap(ap);
+						if ( scanp )
+							scan_found(ap);
+					}
+					break;
+				case 0x0105:	// "+CIPSTAMAC:\"",
+					b = read_buf(0,'"');
+					break;
+				case 0x0106:	// +CIPSTO:
+				case 0x0107:	// +CIPMODE:0
+				case 0x0108:	// +CIPMUX:1
+					b = read_id();
+					set_value(resp_id);
+					break;
+				case 0x0200:	// "OK",
+					events.set(EvOk);
+					break;
+				case 0x0201:	// "FAIL",
+					events.set(EvFail);
+					break;
+				case 0x0202:	// "ERROR",
+					events.set(EvError);
+					break;
+				case 0x0300:	// "SEND OK",
+					events.set(EvSendOk);
+					break;
+				case 0x0301:	// "SEND FAIL",
+					events.set(EvSendFail);
+					break;
+				case 0x0400:	// ",CONNECT",
+					{
+						accept_t acc_cb = 0;
+						void *acc_arg = 0;
+						bool opened = false;
+
+						{
+							ESPGuard guard(statelock);
+							s_state *statep = lookup(resp_id);
+							if ( statep && !statep->open ) {
+								opened = true;
+								statep->open = 1;
+								statep->connected = 1;
+								statep->disconnected = 0;
+								statep->rxq.reset();
+								statep->cbuf = 0;
+								statep->clen = 0;
+								statep->cerror = Ok;
+								statep->prio = 0;
+								if ( queue ) {
+									if ( enqueue(QAccept,resp_id,0) ) {
+										queue->commit();
+										events.set(EvQueued);
+									}
+								} else	{
+									acc_cb = accept_cb;
+									acc_arg = accept_arg;
+								}
+							}
+						}
+
+						if ( acc_cb )		// Called unlocked: it may accept()
+							acc_cb(resp_id,acc_arg);
+						if ( opened )
+							notify_sock(resp_id,PollOut);
+					}
+					break;
+				case 0x0500:	// ",CLOSED",
+					{
+						recv_func_t rx_cb = 0;
+						void *rx_arg = 0;
+						bool closed = false;
+
+						{
+							ESPGuard guard(statelock);
+							s_state *statep = lookup(resp_id);
+							if ( statep && statep->open ) {
+								closed = true;
+								statep->connected = 0;
+								if ( queue ) {
+									if ( enqueue(QClosed,resp_id,0) ) {
+										queue->commit();
+										events.set(EvQueued);
+									}
+								} else	{
+									rx_cb = statep->rxcallback;
+									rx_arg = statep->rxarg;
+								}
+								statep->disconnected = 1;
+							}
+						}
+
+						if ( rx_cb )		// Called unlocked: it may close()
+							rx_cb(resp_id,-1,rx_arg);
+						if ( closed )
+							notify_sock(resp_id,PollHup);
+						events.set(EvClosed);
+					}
+					break;
+				case 0x0600:	// "DNS Fail",
+					events.set(EvDnsFail);
+					break;
+				case 0x0700:	// "WIFI DISCONNECT",
+					events.clear(EvWifiConnected|EvGotIp);
+					break;
+				case 0x0701:	// "WIFI CONNECT",
+					events.set(EvWifiConnected);
+					break;
+				case 0x0702:	// "WIFI GOT IP",
+					events.set(EvGotIp);
+					break;
+				case 0x0800:	// "AT version:",
+					b = read_buf(0,'\r');
+					first = 0;
+					break;
+				case 0x0900:	// No AP
+					events.clear(EvWifiConnected|EvGotIp);
+					break;
+				case 0x0A00:	// "busy p...",
+				case 0x0A01:	// "busy s...",
+					events.set(EvBusy);
+					break;
+				case 0x7F00:	// "ready\r",
+					clear(true);
+					events.set(EvReady);
+					break;
+				}
+				first = 0;
+			}
+		} else	{
+			bool matched = false;
+			const char *cur = rxstate[s0].pattern;
+
+			while ( rxstate[++s0].pattern && !strncmp(cur,rxstate[s0].pattern,ss) ) {
+				if ( ss == rxstate[s0].start && rxstate[s0].pattern[ss] == b ) {
+					matched = true;
+					break;
+				}
+			}
+			
+			if ( !matched )
+				first = 0;
+			else	++ss;
+		}
+	}
+	idle();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Reserve room for a queue record and put its header: the caller then
+// puts len data bytes and commits (returns false if the queue is full)
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::enqueue(QRecord type,int sock,int len) {
+
+	if ( !queue->reserve(4+len) )
+		return false;
+
+	queue->put(char(type));
+	queue->put(char(sock));
+	queue->put(char(len));
+	queue->put(char(len >> 8));
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Invoke the callbacks for the records queued by receive(). The
+// receive callback is looked up now, so that data for a socket
+// accepted by an earlier record reaches its new callback.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+unsigned
+ESP8266T<N,Io>::dispatch() {
+	unsigned count = 0;
+
+	if ( !queue )
+		return 0;
+
+	while ( queue->available() > 0 ) {	// Records are committed whole
+		QRecord type = QRecord(queue->peek(0));
+		int sock = queue->peek(1);
+		int len = (unsigned char)queue->peek(2) | (unsigned char)queue->peek(3) << 8;
+
+		if ( type == QAccept ) {
+			if ( accept_cb )
+				accept_cb(sock,accept_arg);
+		} else	{
+			recv_func_t rx_cb = 0;
+			void *rx_arg = 0;
+
+			{
+				ESPGuard guard(statelock);
+				s_state *statep = lookup(sock);
+
+				if ( statep ) {
+					rx_cb = statep->rxcallback;
+					rx_arg = statep->rxarg;
+				}
+			}
+
+			if ( rx_cb ) {
+				for ( int x=0; x<len; ++x )
+					rx_cb(sock,queue->peek(4+x),rx_arg);
+				if ( type != QData )
+					rx_cb(sock,-1,rx_arg);	// End of datagram, or closed
+			}
+		}
+
+		queue->consume(4+len);
+		++count;
+	}
+	return count;
+}
+
+#ifdef ESP_SYNC_BLOCKING
+
+//////////////////////////////////////////////////////////////////////
+// Receiver thread: runs receive() until stop_receiver(). The Io
+// policy's idle() should block briefly (as ESPSerial::idle() does),
+// so that this thread sleeps while the device is quiet.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::receiver(void *arg) {
+	ESP8266T& esp = *(ESP8266T *)arg;
+
+	while ( !esp.rxstop )
+		esp.receive();
+}
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::start_receiver() {
+	rxstop = false;
+	return rxthread.start(receiver,this);
+}
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::stop_receiver() {
+	rxstop = true;
+	rxthread.join();
+}
+
+#endif // ESP_SYNC_BLOCKING
+
+//////////////////////////////////////////////////////////////////////
+// Ignore data until LF is read
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::waitlf() {
+	while ( readb() != '\n' )
+		;
+	first = '\n';
+}
+
+//////////////////////////////////////////////////////////////////////
+// Wait until any of the event bits in mask are set, returning them.
+// Without an RTOS, this runs the receiver. Under an RTOS, receive()
+// runs in another thread and sets the bits, waking this caller.
+// Returns EvCancel instead once cancel() is called.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+unsigned
+ESP8266T<N,Io>::await(unsigned mask) {
+	unsigned bits;
+
+	while ( !(bits = events.get() & mask) ) {
+		if ( cancelled )
+			return EvCancel;
+#ifdef USING_RTOS
+		events.wait(mask|EvCancel);
+#else
+		receive();
+#endif
+	}
+	return bits;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Cancel (or with on=false, allow again) commands and their waits.
+// This may be called from any thread, without cmdlock.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::cancel(bool on) {
+
+	cancelled = on;
+	if ( on )
+		events.set(EvCancel);		// Wakes a blocked await()
+	else	events.clear(EvCancel);
+}
+
+//////////////////////////////////////////////////////////////////////
+// (Software) Reset the ESP8266
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::reset() {
+	CmdLock lock(*this);
+
+	YIELD();
+
+	// Reset
+	events.clear(EvReady);
+	first = '\n';
+	CMD("AT+RST");
+	command("AT+RST");
+
+	await(EvReady);
+
+	return start();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Here we assume that the ESP8266 pin has been activated and now
+// must wait for the reception of the "ready" message. Currently
+// this method waits forever if the ready message does not arrive.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::wait_reset() {
+	CmdLock lock(*this);
+
+	events.clear(EvReady);
+	await(EvReady);
+	return start();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set operational parameters:
+//
+// This method simply turns off echo (ATE0), sets AT+CIPMODE=0 and
+// makes certain that we have AT+CIPMUX=1 mode established for TCP/UDP.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::start() {
+	CmdLock lock(*this);
+
+	// Disable echo
+	CMD("ATE0");
+	command("ATE0");
+	if ( !waitokfail(CmdIdempotent) )
+		return false;
+
+	if ( !set_cipmode(0) )	// Check/set AT+CIPMODE=0
+		return false;
+
+	if ( !set_cipmux(1) )	// Check/set AT+CIPMUX=1
+		return false;
+
+	if ( flow_baud > 0 && !set_uart(flow_baud,flow) )
+		return false;
+
+	close_all();
+
+	return true;		// WIFI connected
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set the module's UART (current, not saved to flash):
+// AT+UART_CUR=baudrate,8,1,0,flow
+//
+// The OK comes at the old baud rate: change the host's baud rate after
+// this returns, when it differs.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::set_uart(unsigned long baudrate,UartFlow fc) {
+	CmdLock lock(*this);
+	char buf[16];
+
+	CMD("AT+UART_CUR=...");
+	events.clear(EvResp);
+	write("AT+UART_CUR=");
+	write(int2str(int(baudrate),buf,sizeof buf));
+	write(",8,1,0,");
+	write(int2str(int(fc),buf,sizeof buf));
+	crlf();
+
+	if ( !waitokfail(CmdIdempotent) ) {
+		error = Fail;
+		return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Wait until WIFI CONNECTED occurs.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::wait_wifi(bool got_ip) {
+
+	await(EvWifiConnected);
+
+	if ( got_ip )
+		await(EvGotIp);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Return true if we have WIFI (AP), optionally with IP
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::is_wifi(bool got_ip) {
+	CmdLock lock(*this);
+	int ch, db;
+
+	if ( !get_ap_ssid(0,0,0,0,ch,db) )
+		return false;
+
+	if ( !got_ip )
+		return events.get() & EvWifiConnected;
+
+	//////////////////////////////////////////////////////////////
+	// AT+CIPAP?
+	// +CIPSTA:ip:"192.168.0.73"
+	// +CIPSTA:gateway:"192.168.0.1"
+	// +CIPSTA:netmask:"255.255.255.0"
+	// 
+	// OK
+	//////////////////////////////////////////////////////////////
+
+	char ip[32];
+
+	if ( !get_ap_info(ip,sizeof ip,0,0,0,0) )
+		return false;
+
+	return events.get() & EvGotIp;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Access point connect
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::ap_join(const char *ap,const char *passwd,bool fast) {
+	CmdLock lock(*this);
+	unsigned long t0 = io.millis();
+	bool bf = false;
+
+	join.fast = fast && join.bssid[0] && !strcmp(join.ssid,ap);
+	if ( join.fast && !(bf = join_cmd(ap,passwd,join.bssid)) ) {
+		join.fast = false;		// AP gone: forget it, join any
+		set_join_bssid(0,0);
+	}
+	if ( !bf )
+		bf = join_cmd(ap,passwd,0);
+	join.ms = io.millis() - t0;
+
+	if ( bf && fast && !join.fast ) {
+		int ch, db;
+
+		get_ap_ssid(0,0,0,0,ch,db);	// Learn the AP for next time
+	}
+	if ( !bf )
+		error = Fail;
+	return bf;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Connect to WIFI AP, optionally only the AP with bssid:
+// AT+CWJAP="ssid","password"[,"bssid"]
+// (no channel can be given, so the module still scans for the BSSID)
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::join_cmd(const char *ap,const char *passwd,const char *bssid) {
+
+	events.clear(EvResp|EvClosed|EvDnsFail);
+
+	write("AT+CWJAP=\"");
+	write(ap);
+	write("\",\"");
+	if ( passwd )
+		write(passwd);
+	write("\"");
+	if ( bssid ) {
+		write(",\"");
+		write(bssid);
+		write("\"");
+	}
+	crlf();
+
+	return waitokfail();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set the AP that ap_join(...,true) pins for ssid (nullptr forgets)
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::set_join_bssid(const char *ssid,const char *bssid) {
+
+	if ( !ssid || !bssid || strlen(ssid) >= sizeof join.ssid || strlen(bssid) + 1 != sizeof join.bssid ) {
+		join.ssid[0] = join.bssid[0] = 0;
+		return;
+	}
+	strcpy(join.ssid,ssid);
+	strcpy(join.bssid,bssid);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write CRLF
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::crlf() {
+	writeb('\r');
+	writeb('\n');
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write a nul terminated string
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::write(const char *str) {
+	while ( *str )
+		writeb(*str++);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write a command
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::command(const char *cmd) {
+
+	events.clear(EvResp);
+	write(cmd);
+	crlf();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Issue ESP command and wait for OK/FAIL/ERROR (returns true for OK)
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::commandok(const char *cmd,unsigned flags) {
+	CmdLock lock(*this);
+
+	command(cmd);
+	return waitokfail(flags);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read until we get OK/FAIL. The caller clears EvResp before writing
+// the command, so that a fast response cannot be missed. Per the retry
+// policy, a command answered busy (or FAIL/ERROR, if CmdIdempotent)
+// is written again from cmdline[] after the backoff (at once, if there
+// is no clock to time it).
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::waitokfail(unsigned flags) {
+	unsigned long backoff = retry.backoff;
+
+	for ( int attempt = 1;; ++attempt ) {
+		unsigned ev = await(EvResp);
+
+		if ( ev & EvOk )
+			return true;
+		if ( (ev & EvCancel) || (flags & CmdNoRetry) || retry.attempts <= 1 || !cmddone || cmdlen > CmdMax )
+			return false;
+		if ( !(ev & EvBusy) && !(flags & CmdIdempotent) )
+			return false;		// Not safe to repeat
+		if ( attempt >= retry.attempts ) {
+			++retry.giveups;
+			return false;
+		}
+
+		if ( backoff > 0 && io.has_clock() ) {
+			unsigned long t0 = io.millis();
+
+			while ( io.millis() - t0 < backoff )
+				YIELD();
+			if ( (backoff *= 2) > retry.max_backoff )
+				backoff = retry.max_backoff;
+		}
+
+		++retry.retries;
+		events.clear(EvResp);
+		io.writebuf(cmdline,cmdlen);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set the command retry policy
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::set_retry(int attempts,unsigned long backoff_ms,unsigned long max_backoff_ms) {
+
+	retry.attempts = attempts > 0 ? attempts : 1;
+	retry.backoff = backoff_ms;
+	retry.max_backoff = max_backoff_ms > backoff_ms ? max_backoff_ms : backoff_ms;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Start a TCP or UDP socket
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::socket(const char *socktype,const char *host,int port,recv_func_t rx_cb,void *rx_user,int local_port) {
+	CmdLock lock(*this);
+	bool udp = socktype[0] == 'U';
+
+	YIELD();
+
+	int sock = alloc_socket(udp,host,port,local_port);
+	if ( sock < 0 )
+		return -1;		// No free sessions
+
+	events.clear(EvResp|EvClosed|EvDnsFail);
+	cipstart(sock,udp,host,port,local_port);
+
+	bool ok = waitokfail();
+	ESPGuard guard(statelock);
+	s_state& s = state[sock];
+
+	if ( !ok ) {
+		if ( events.get() & EvDnsFail )
+			error = DNS_Fail;
+		else	error = Fail;
+		s.open = 0;
+		return -1;
+	}
+
+	s.connected = 1;
+	s.rxcallback = rx_cb;
+	s.rxarg = rx_user;
+	return sock;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Allocate and initialize a socket's state (error Resource if none)
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::alloc_socket(bool udp,const char *host,int port,int local_port) {
+	ESPGuard guard(statelock);
+	int sock = -1;
+
+	for ( int x=0; x<N; ++x ) {
+		if ( !state[x].open ) {
+			sock = x;
+			break;
+		}
+	}
+
+	if ( sock == -1 ) {
+		error = Resource;
+		return -1;
+	}
+
+	s_state& s = state[sock];
+
+	s.open = 1;	// Mark it as allocated (for now)
+	s.udp = udp;
+	s.disconnected = 0;
+	s.connecting = s.failed = 0;
+	s.rxq.reset();
+	s.cbuf = 0;
+	s.clen = 0;
+	s.cerror = Ok;
+	s.prio = 0;
+	s.raddr = str2ip(host);
+	s.rport = port;
+	s.lport = local_port >= 0 ? local_port : 0;
+	return sock;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write the AT+CIPSTART command for sock
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::cipstart(int sock,bool udp,const char *host,int port,int local_port) {
+	const char *socktype = udp ? "UDP" : "TCP";
+
+	CMDX("AT+CIPSTART=");
+	write("AT+CIPSTART=");
+
+	CMDC('0' + sock);
+	writeb('0' + sock);
+	
+	CMDX(",\"");
+	write(",\"");
+
+	CMDX(socktype);
+	write(socktype);
+
+	CMDX("\",\"");
+	write("\",\"");
+	CMDX(host);
+	write(host);
+	CMDX("\",");
+	write("\",");
+
+	// Convert port to string
+	{
+		char portbuf[16];
+		const char *portstr = int2str(port,portbuf,sizeof portbuf);
+		CMDX(portstr);
+		write(portstr);
+	}
+
+	if ( local_port >= 0 ) {
+		char lportbuf[16];
+		const char *lportstr = int2str(local_port,lportbuf,sizeof lportbuf);
+		CMDC(',');
+		writeb(',');
+		CMDX(lportstr);
+		write(lportstr);
+		CMDX(",2");
+		write(",2");
+	}
+
+	CMDC('\n');
+	crlf();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Start TCP connect to host, port. Returns socket if successful,
+// else -1 if an error occurred.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::tcp_connect(const char *host,int port,recv_func_t rx_cb,void *user) {
+	return socket("TCP",host,port,rx_cb,user,-1);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Open a UDP socket for sending to host and port
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::udp_socket(const char *host,int port,recv_func_t rx_cb,int local_port,void *user) {
+	return socket("UDP",host,port,rx_cb,user,local_port);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Allocate a socket and submit its connect, returning at once with
+// the socket (else -1). The connect is completed by advance().
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::socket_async(bool udp,const char *host,int port,recv_func_t rx_cb,void *rx_user,int local_port,connect_t conn_cb) {
+	int sock = alloc_socket(udp,host,port,local_port);
+
+	if ( sock < 0 )
+		return -1;		// No free sessions
+
+	{
+		ESPGuard guard(statelock);
+		s_state& s = state[sock];
+		AsyncOp& op = s.connop;
+
+		s.connecting = 1;
+		s.conncallback = conn_cb;
+
+		op.kind = OpConnect;
+		op.sock = sock;
+		op.str = host;
+		op.len = port;
+		op.lport = local_port;
+		op.udp = udp;
+		op.rx_cb = rx_cb;
+		op.rx_user = rx_user;
+		op.done = connected;
+		op.user = this;
+	}
+
+	submit(state[sock].connop);
+	return sock;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Asynchronous connect completed (user is the ESP8266T)
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::connected(AsyncOp& op,void *user) {
+	ESP8266T& esp = *(ESP8266T *)user;
+	connect_t conn_cb;
+
+	{
+		ESPGuard guard(esp.statelock);
+		conn_cb = esp.state[op.sock].conncallback;
+	}
+	if ( conn_cb )
+		conn_cb(op.sock,op.error,op.rx_user);
+	esp.notify_sock(op.sock,op.error == Ok ? PollOut : PollErr);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Start a TCP connect to host, port without waiting
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::tcp_connect_async(const char *host,int port,recv_func_t rx_cb,void *user,connect_t conn_cb) {
+	return socket_async(false,host,port,rx_cb,user,-1,conn_cb);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Open a UDP socket without waiting
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::udp_socket_async(const char *host,int port,recv_func_t rx_cb,int local_port,void *user,connect_t conn_cb) {
+	return socket_async(true,host,port,rx_cb,user,local_port,conn_cb);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Return the state of a socket
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+typename ESP8266T<N,Io>::SockState
+ESP8266T<N,Io>::get_state(int sock) {
+	ESPGuard guard(statelock);
+	s_state *statep = lookup(sock);
+
+	if ( !statep || !statep->open )
+		return SockClosed;
+	else if ( statep->connecting )
+		return SockConnecting;
+	else if ( statep->failed )
+		return SockFailed;
+	else if ( statep->disconnected )
+		return SockDisconnected;
+	return SockOpen;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Divide buf into a receive ring for each socket. Each ring is the
+// largest power of two that fits in size / N.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::set_rx_buffers(char *buf,unsigned size) {
+	unsigned ringsiz = 1;
+
+	while ( ringsiz * 2 <= size / N )
+		ringsiz *= 2;
+
+	ESPGuard guard(statelock);
+
+	for ( int sock=0; sock<N; ++sock )
+		state[sock].rxq.init(buf + sock * ringsiz,ringsiz);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read up to bytes of buffered data from a socket without waiting.
+// Returns 0 when none is buffered (see poll() for PollHup).
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::recv(int sock,char *buf,int bytes) {
+	ESPQueue *rxq;
+
+	{
+		ESPGuard guard(statelock);
+		s_state *statep = lookup(sock);
+
+		if ( !statep || !statep->open || !statep->rxq.size() || !buf || bytes < 0 ) {
+			error = Invalid;
+			return -1;
+		}
+		rxq = &statep->rxq;
+	}
+
+	int n = rxq->available();
+
+	if ( n > bytes )
+		n = bytes;
+	for ( int x=0; x<n; ++x )
+		buf[x] = rxq->peek(x);
+	rxq->consume(n);
+	return n;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Bytes dropped for a socket, because its receive ring was full
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+unsigned long
+ESP8266T<N,Io>::get_rx_overflows(int sock) {
+	ESPGuard guard(statelock);
+	s_state *statep = lookup(sock);
+
+	return statep ? statep->rxq.get_overflows() : 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Return true if a send to sock is queued (asynchronous operations)
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::send_pending(int sock) {
+
+	for ( AsyncOp *op = ophead; op; op = op->next )
+		if ( op->kind == OpSend && op->sock == sock )
+			return true;
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Return the PollEvent bits that apply to sock now
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+short
+ESP8266T<N,Io>::poll_events(int sock) {
+	ESPGuard guard(statelock);
+	s_state *statep = lookup(sock);
+	short ev = 0;
+
+	if ( !statep || !statep->open )
+		return PollNval;
+	if ( statep->rxq.available() > 0 )
+		ev |= PollIn;
+	if ( statep->failed )
+		ev |= PollErr;
+	else if ( statep->disconnected )
+		ev |= PollHup;
+	else if ( statep->connected && !send_pending(sock) )
+		ev |= PollOut;
+	return ev;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Wait up to timeout_ms (0 does not wait, -1 waits forever) until
+// any of the sockets in fds are ready. PollErr, PollHup and PollNval
+// are always reported. Returns the number of fds with revents set.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::poll(PollFd *fds,int nfds,long timeout_ms) {
+	unsigned long t0 = io.millis();
+	int count;
+
+	for (;;) {
+		YIELD();			// Receive (or let the receiver thread run)
+		if ( !advance() )
+			flush_due();		// Blocking: only with no operations pending
+
+		count = 0;
+		for ( int x=0; x<nfds; ++x ) {
+			PollFd& fd = fds[x];
+
+			fd.revents = poll_events(fd.sock) & (fd.events|PollErr|PollHup|PollNval);
+			if ( fd.revents )
+				++count;
+		}
+
+		if ( count > 0 || timeout_ms == 0 )
+			return count;
+		if ( timeout_ms > 0 && io.millis() - t0 >= (unsigned long)timeout_ms )
+			return 0;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Return the error of a failed asynchronous connect (else Ok)
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+typename ESP8266T<N,Io>::Error
+ESP8266T<N,Io>::get_sock_error(int sock) {
+	ESPGuard guard(statelock);
+	s_state *statep = lookup(sock);
+
+	if ( !statep || !statep->open || !statep->failed )
+		return Ok;
+	return statep->connop.error;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Close a socket.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::close(int sock) {
+	CmdLock lock(*this);
+	bool ok;
+
+	flush(sock);				// Send any coalesced bytes first
+
+	{
+		ESPGuard guard(statelock);
+		s_state *statep = lookup(sock);
+
+		if ( !statep || !statep->open || statep->connecting ) {
+			error = Invalid;
+			return false;
+		}
+
+		statep->open = 0;
+		if ( !statep->connected )
+			return true;
+		statep->connected = 0;
+	}
+
+	{
+		char sockbuf[16];
+		const char *sockstr = int2str(sock,sockbuf,sizeof sockbuf);
+
+		events.clear(EvResp);
+		write("AT+CIPCLOSE=");
+		write(sockstr);
+		crlf();
+	}
+
+	ok = waitokfail();
+	if ( !ok )
+		error = Fail;
+
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Close all sockets (ignoring errors)
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::close_all() {
+	CmdLock lock(*this);
+
+	for ( int s=0; s<N; ++s ) {
+		close(s);			// Attempt to close on ESP side
+
+		ESPGuard guard(statelock);
+		state[s].open = 0;		// Force close on our side
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write to a socket.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::write(int sock,const char *data,int bytes,const char *udp_address) {
+	CmdLock lock(*this);
+	IoVec parts[2];
+	char *cbuf = 0;
+	int clen = 0, csize = 0;
+
+	if ( !data ) {
+		error = Invalid;
+		return -1;
+	}
+
+	if ( !udp_address ) {
+		ESPGuard guard(statelock);
+		s_state *statep = lookup(sock);
+
+		if ( statep && statep->cbuf ) {
+			if ( statep->cerror != Ok ) {	// A deferred flush failed
+				error = statep->cerror;
+				statep->cerror = Ok;
+				return -1;
+			} else if ( statep->disconnected ) {
+				error = Disconnected;
+				return -1;
+			} else if ( !statep->connected ) {
+				error = Invalid;
+				return -1;
+			}
+			cbuf = statep->cbuf;
+			clen = statep->clen;
+			csize = statep->csize;
+		}
+	}
+
+	if ( cbuf && bytes >= 0 ) {
+		if ( clen + bytes <= csize ) {	// Hold the bytes
+			ESPGuard guard(statelock);
+			s_state& s = state[sock];
+
+			memcpy(cbuf+clen,data,bytes);
+			if ( !clen )
+				s.ct0 = io.millis();
+			s.clen = clen + bytes;
+			if ( s.clen < csize && io.millis() - s.ct0 < s.cdelay )
+				return bytes;
+		}
+
+		{
+			ESPGuard guard(statelock);
+			state[sock].clen = 0;
+		}
+
+		if ( clen + bytes <= csize ) {	// Full, or delay passed
+			parts[0].base = cbuf;
+			parts[0].len = clen + bytes;
+			return writev(sock,parts,1) < 0 ? -1 : bytes;
+		}
+		parts[0].base = cbuf;		// Held bytes, then these
+		parts[0].len = clen;
+		parts[1].base = data;
+		parts[1].len = bytes;
+		return writev(sock,parts,2) < 0 ? -1 : bytes;
+	}
+
+	parts[0].base = data;
+	parts[0].len = bytes;
+	return writev(sock,parts,1,udp_address);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Enable coalescing of small TCP writes into buf (nullptr disables,
+// after sending any bytes still held)
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::set_coalesce(int sock,char *buf,int size,int delay_ms) {
+	CmdLock lock(*this);
+
+	{
+		ESPGuard guard(statelock);
+		s_state *statep = lookup(sock);
+
+		if ( !statep || !statep->open || statep->udp || (buf && (size < 1 || size > 0xFFFF || delay_ms < 0 || delay_ms > 0xFFFF)) ) {
+			error = Invalid;
+			return false;
+		}
+	}
+
+	flush(sock);
+
+	ESPGuard guard(statelock);
+	s_state& s = state[sock];
+
+	s.cbuf = buf;
+	s.csize = buf ? size : 0;
+	s.cdelay = delay_ms;
+	s.clen = 0;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Send the bytes held for sock (returns 0 if none), else -1, also when
+// flush_due() failed to send them earlier
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::flush(int sock) {
+	CmdLock lock(*this);
+	IoVec part;
+
+	{
+		ESPGuard guard(statelock);
+		s_state *statep = lookup(sock);
+
+		if ( !statep ) {
+			error = Invalid;
+			return -1;
+		}
+		if ( statep->cerror != Ok ) {
+			error = statep->cerror;
+			statep->cerror = Ok;
+			return -1;
+		}
+		if ( !statep->cbuf || !statep->clen )
+			return 0;
+		part.base = statep->cbuf;
+		part.len = statep->clen;
+		statep->clen = 0;
+	}
+	return writev(sock,&part,1);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Flush each socket whose oldest held byte has waited its delay. A
+// failure is kept for the socket's next write() or flush().
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::flush_due() {
+	CmdLock lock(*this);
+	unsigned long now = io.millis();
+	int count = 0;
+
+	for ( int sock=0; sock<N; ++sock ) {
+		bool due;
+
+		{
+			ESPGuard guard(statelock);
+			s_state& s = state[sock];
+
+			due = s.cbuf && s.clen > 0 && now - s.ct0 >= s.cdelay;
+		}
+		if ( due ) {
+			if ( flush(sock) < 0 ) {
+				ESPGuard guard(statelock);
+				state[sock].cerror = error;
+			}
+			++count;
+		}
+	}
+	return count;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write parts to a socket, as if they were one buffer: each AT+CIPSEND
+// segment (up to 1500 bytes) is gathered from as many parts as fit,
+// so a header and body go out together without copying. For UDP, each
+// segment is one datagram.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::writev(int sock,const IoVec *parts,int n,const char *udp_address) {
+	PartSource src = { parts, 0, 0 };
+	int bytes = 0;
+
+	if ( !parts || n < 0 ) {
+		error = Invalid;
+		return -1;
+	}
+
+	for ( int x=0; x<n; ++x ) {
+		if ( parts[x].len < 0 || (parts[x].len > 0 && !parts[x].base) ) {
+			error = Invalid;
+			return -1;
+		}
+		bytes += parts[x].len;
+	}
+	return send_segments(sock,bytes,src,udp_address);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write bytes to a socket, pulling each byte from prod_cb as the
+// AT+CIPSEND segment is written (after the '>' prompt), so that no
+// buffer is needed for the payload
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::write_stream(int sock,int bytes,produce_t prod_cb,void *user,const char *udp_address) {
+	ProducerSource src = { sock, prod_cb, user, false };
+
+	if ( !prod_cb || bytes < 0 ) {
+		error = Invalid;
+		return -1;
+	}
+	return send_segments(sock,bytes,src,udp_address);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Send bytes from src (PartSource or ProducerSource) in AT+CIPSEND
+// segments of up to 1500 bytes. Contiguous spans go to Io::writebuf()
+// in one call. Returns bytes sent, else -1.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+template <class Src>
+int
+ESP8266T<N,Io>::send_segments(int sock,int bytes,Src& src,const char *udp_address) {
+	CmdLock lock(*this);
+	int wlen, tlen = 0;
+	bool bf, disconnected, connected, udp, ended = false;
+
+	{
+		ESPGuard guard(statelock);
+		s_state *statep = lookup(sock);
+
+		if ( !statep ) {
+			error = Invalid;
+			return -1;
+		}
+		disconnected = statep->disconnected;
+		connected = statep->connected;
+		udp = statep->udp;
+	}
+
+	if ( disconnected ) {
+		error = Disconnected;
+		return -1;
+	} else if ( !connected || (udp_address && !udp) ) {
+		error = Invalid;
+		return -1;
+	} else if ( bytes == 0 )
+		return 0;
+
+	while ( bytes > 0 ) {
+		if ( (wlen = bytes) > 1500 )
+			wlen = 1500;
+
+		for ( int tries = 1;; ++tries ) {
+			while ( !pace_due() )
+				YIELD();
+
+			events.clear(EvSendReady|EvSendOk|EvSendFail|EvResp);
+			cipsend(sock,wlen,udp_address);
+
+			bf = waitokfail(CmdNoRetry);	// Busy is paced here
+			if ( bf )
+				break;
+			if ( events.get() & EvBusy )
+				pace_backoff(true);	// Not taken: retry
+			if ( !(events.get() & EvBusy) || tries >= PaceRetries ) {
+				error = Fail;
+				return -1;
+			}
+		}
+
+		if ( await(EvSendReady) & EvCancel ) {
+			error = Fail;
+			return -1;
+		}
+
+		for ( int count = wlen; count > 0; ) {
+			const char *data;
+			int n = src.span(data,count);
+
+			if ( n > 0 ) {			// Write in place
+				if ( capture_cb )
+					for ( int x=0; x<n; ++x )
+						capture_cb(sock,true,data[x],capture_arg);
+				writebuf(data,n);
+				count -= n;
+				continue;
+			}
+
+			int ch = src.next();
+
+			if ( ch < 0 ) {
+				ended = true;		// Source ended early:
+				ch = 0;			// pad out the segment
+			}
+			if ( capture_cb )
+				capture_cb(sock,true,char(ch),capture_arg);
+			io.writeb(char(ch));		// Payload (not a command byte)
+			--count;
+		}
+		if ( capture_cb )
+			capture_cb(sock,true,-1,capture_arg);	// End of captured segment
+		pace_sent();
+
+		if ( await(EvSendOk|EvSendFail) & (EvSendFail|EvCancel) ) {
+			pace_backoff(true);
+			break;
+		}
+		pace_ok(wlen);
+
+		if ( ended ) {
+			error = Invalid;
+			return -1;
+		}
+
+		tlen += wlen;
+		bytes -= wlen;
+	}
+
+	if ( !(events.get() & EvSendOk) )
+		error = Fail;
+
+	return events.get() & EvSendOk ? tlen : -1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write the AT+CIPSEND command for bytes of data
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::cipsend(int sock,int bytes,const char *udp_address) {
+	char buf[16];
+
+	write("AT+CIPSEND=");
+	writeb('0' + sock);
+	writeb(',');
+
+	if ( udp_address ) {
+		// Not supported on all ESP devices
+		writeb('"');
+		write(udp_address);
+		write("\",");
+	}
+
+	write(int2str(bytes,buf,sizeof buf));
+	crlf();
+	pace_cmd(bytes);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Enable or disable adaptive send pacing. The pacing times come from
+// Io::millis(): without a clock the send would never fall due, so
+// pacing stays off.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::set_pacing(bool on) {
+
+	pace.on = on && io.has_clock();
+	pace.rate = 0;
+	pace.est = pace.base = 0;
+	pace.samples = 0;
+	return pace.on == on;
+}
+
+//////////////////////////////////////////////////////////////////////
+// An AT+CIPSEND for bytes was written: when paced, the next may not
+// go until bytes at the paced rate have passed
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::pace_cmd(int bytes) {
+
+	pace.t_cmd = pace.t_sent = io.millis();
+	if ( pace.on && pace.rate )
+		pace.t_due = pace.t_cmd + bytes * 1000UL / pace.rate;
+}
+
+//////////////////////////////////////////////////////////////////////
+// SEND OK for bytes: update the service rate and the latency baseline,
+// then back off if the latency per byte doubled, else probe upwards
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::pace_ok(int bytes) {
+
+	if ( !pace.on || bytes <= 0 )
+		return;
+
+	unsigned long now = io.millis();
+	unsigned long svc = now - pace.t_cmd, lat = now - pace.t_sent;
+	unsigned long sample = bytes * 1000UL / (svc ? svc : 1);
+	bool congested = false;
+
+	pace.est = pace.est ? (pace.est * 7 + sample) / 8 : sample;
+
+	if ( bytes >= PaceSample ) {		// Latency scales with length
+		unsigned long cost = lat * 1000UL / bytes;
+
+		if ( !pace.base || cost < pace.base ) {
+			pace.base = cost;
+			pace.samples = 0;
+		} else if ( ++pace.samples >= 64 ) {
+			pace.base += pace.base / 8 + 1;	// Follow a slower link
+			pace.samples = 0;
+		}
+		congested = lat > PaceLatency && cost > pace.base * 2;
+	}
+
+	if ( congested )
+		pace_backoff(false);
+	else if ( pace.rate && (pace.rate += PaceStep) >= pace.est )
+		pace.rate = 0;			// No longer the limit: unpaced
+}
+
+//////////////////////////////////////////////////////////////////////
+// Congestion: cut the send rate (from the service rate, if unpaced) by
+// a quarter on latency, or by half and hold off for PaceHold ms after
+// busy or SEND FAIL
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::pace_backoff(bool busy) {
+
+	if ( busy )
+		++pace.busy;
+	if ( !pace.on )
+		return;
+
+	unsigned long now = io.millis();
+
+	unsigned long rate = pace.rate ? pace.rate : pace.est;
+
+	pace.rate = busy ? rate / 2 : rate - rate / 4;
+	if ( pace.rate < PaceMinRate )
+		pace.rate = PaceMinRate;
+	++pace.backoffs;
+	if ( busy && long(now + PaceHold - pace.t_due) > 0 )
+		pace.t_due = now + PaceHold;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Queue an asynchronous operation. The op must remain valid until its
+// done callback is called (from advance()).
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::submit(AsyncOp& op) {
+
+	op.next = 0;
+	op.phase = 0;
+	op.tries = 0;
+	op.result = -1;
+	op.error = Ok;
+
+	if ( optail )
+		optail->next = &op;
+	else	ophead = &op;
+	optail = &op;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set the transmit priority of an open socket's operations
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::set_priority(int sock,int prio) {
+	ESPGuard guard(statelock);
+	s_state *statep = lookup(sock);
+
+	if ( !statep || !statep->open || prio < 0 || prio > 255 ) {
+		error = Invalid;
+		return false;
+	}
+	statep->prio = prio;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Choose the operation to run next, and move it to ophead: the first
+// operation of each socket is eligible (up to any OpCommand), and the
+// highest priority wins, then the socket next after lastsock.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::schedule() {
+	AsyncOp *best = 0, *bestprev = 0, *prev = 0;
+	int bestkey = N, bestprio = 0, bestdist = 0;
+	bool seen[N + 1];			// Keys with an earlier operation (any N)
+
+	memset(seen,0,sizeof seen);
+
+	for ( AsyncOp *op = ophead; op; prev = op, op = op->next ) {
+		if ( op->kind == OpCommand ) {
+			if ( !best ) {		// Commands are not reordered
+				best = op;
+				bestprev = prev;
+			}
+			break;
+		}
+
+		int key = op->sock >= 0 && op->sock < N ? op->sock : N;	// N: socket not allocated yet
+
+		if ( seen[key] )
+			continue;		// Must follow the earlier op
+		seen[key] = true;
+
+		int prio = 0;
+
+		if ( key < N ) {
+			ESPGuard guard(statelock);
+			prio = state[key].prio;
+		}
+
+		int dist = (key - lastsock + N) % (N + 1);	// Round robin order
+
+		if ( !best || prio > bestprio || (prio == bestprio && dist < bestdist) ) {
+			best = op;
+			bestprev = prev;
+			bestkey = key;
+			bestprio = prio;
+			bestdist = dist;
+		}
+	}
+
+	if ( best != ophead ) {
+		bestprev->next = best->next;
+		if ( optail == best )
+			optail = bestprev;
+		best->next = ophead;
+		ophead = best;
+	}
+	lastsock = bestkey;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Progress the submitted operations without waiting (see schedule()).
+// Call after receive(). Returns true while operations are pending.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::advance() {
+
+	while ( ophead ) {
+		if ( at_boundary(*ophead) && ophead->next )
+			schedule();
+
+		if ( !step(*ophead) ) {
+			if ( at_boundary(*ophead) )
+				continue;	// Yielded between segments
+			break;
+		}
+
+		AsyncOp& op = *ophead;
+		int sent = op.kind == OpSend ? op.sock : -1;
+
+		if ( !(ophead = op.next) )
+			optail = 0;
+		if ( op.done )
+			op.done(op,op.user);	// May submit more operations (or end op)
+		if ( sent >= 0 && !send_pending(sent) )
+			notify_sock(sent,PollOut);
+	}
+	return ophead != 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Milliseconds until a step is due that no received byte will
+// trigger: an operation not yet issued, an OpSend's paced slot, a
+// busy OpConnect's backoff (all taken by advance()), or held
+// coalesced bytes (flush_due()). Returns 0 if one is already due,
+// else -1 when nothing is timed.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+long
+ESP8266T<N,Io>::next_due() {
+	unsigned long now = io.millis();
+	long due = -1, ms;
+
+	for ( AsyncOp *op = ophead; op; op = op->next ) {
+		if ( op == ophead && op->phase == 0 )
+			ms = 0;			// Submitted outside advance()
+		else if ( op->kind == OpSend && op->phase == 5 )
+			ms = pace_due() ? 0 : long(pace.t_due - now);
+		else if ( op->kind == OpConnect && op->phase == 2 )
+			ms = io.has_clock() ? long(op->due - now) : 0;
+		else	continue;
+		if ( ms < 0 )
+			ms = 0;
+		if ( due < 0 || ms < due )
+			due = ms;
+	}
+
+	if ( !io.has_clock() )
+		return due;			// Held bytes wait for flush(sock)
+
+	ESPGuard guard(statelock);
+
+	for ( int sock=0; sock<N; ++sock ) {
+		const s_state& s = state[sock];
+
+		if ( !s.cbuf || !s.clen )
+			continue;
+		if ( (ms = long(s.cdelay) - long(now - s.ct0)) < 0 )
+			ms = 0;
+		if ( due < 0 || ms < due )
+			due = ms;
+	}
+	return due;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Take op as far as the received responses allow: issue its command,
+// then check the event bits set by receive(). Returns true when op
+// has completed (op.result and op.error set).
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::step(AsyncOp& op) {
+	unsigned ev;
+
+	switch ( op.kind ) {
+	case OpCommand:
+		if ( op.phase == 0 ) {
+			events.clear(EvResp);
+			command(op.str);
+			op.phase = 1;
+			return false;
+		}
+		if ( !(ev = events.get() & EvResp) )
+			return false;
+		if ( ev & EvOk )
+			op.result = 1;
+		else	op.error = Fail;
+		return true;
+
+	case OpConnect:
+		if ( op.phase == 0 ) {
+			if ( op.sock < 0 )
+				op.sock = alloc_socket(op.udp,op.str,op.len,op.lport);
+			if ( op.sock < 0 ) {
+				op.error = Resource;
+				return true;
+			}
+			events.clear(EvResp|EvClosed|EvDnsFail);
+			cipstart(op.sock,op.udp,op.str,op.len,op.lport);
+			op.phase = 1;
+			return false;
+		}
+		if ( op.phase == 2 ) {		// Backoff after busy (set_retry())
+			if ( io.has_clock() && long(io.millis() - op.due) < 0 )
+				return false;
+			++retry.retries;
+			op.phase = 0;
+			return false;		// Written again at the boundary
+		}
+		if ( !(ev = events.get() & EvResp) )
+			return false;
+		if ( ev & EvBusy ) {		// Not taken
+			if ( ++op.tries < retry.attempts ) {
+				unsigned long backoff = retry.backoff << (op.tries - 1);
+
+				op.due = io.millis() + (backoff < retry.max_backoff ? backoff : retry.max_backoff);
+				op.phase = 2;
+				return false;
+			}
+			if ( retry.attempts > 1 )
+				++retry.giveups;
+		}
+		{
+			ESPGuard guard(statelock);
+			s_state& s = state[op.sock];
+
+			if ( ev & EvOk ) {
+				s.connected = 1;
+				s.rxcallback = op.rx_cb;
+				s.rxarg = op.rx_user;
+				op.result = op.sock;
+			} else	{
+				op.error = events.get() & EvDnsFail ? DNS_Fail : Fail;
+				if ( s.connecting )
+					s.failed = 1;	// Held until close()
+				else	s.open = 0;
+			}
+			s.connecting = 0;
+		}
+		return true;
+
+	case OpClose:
+		if ( op.phase == 0 ) {
+			ESPGuard guard(statelock);
+			s_state *statep = lookup(op.sock);
+
+			if ( !statep || !statep->open || statep->connecting ) {
+				op.error = Invalid;
+				return true;
+			}
+			statep->open = 0;
+			if ( !statep->connected ) {
+				op.result = 1;
+				return true;
+			}
+			statep->connected = 0;
+
+			char buf[16];
+
+			events.clear(EvResp);
+			write("AT+CIPCLOSE=");
+			write(int2str(op.sock,buf,sizeof buf));
+			crlf();
+			op.phase = 1;
+			return false;
+		}
+		if ( !(ev = events.get() & EvResp) )
+			return false;
+		if ( ev & EvOk )
+			op.result = 1;
+		else	op.error = Fail;
+		return true;
+
+	case OpSend:
+		for (;;) {
+			int chunk = op.len - op.sent;
+
+			if ( chunk > 1500 )
+				chunk = 1500;
+
+			switch ( op.phase ) {
+			case 0:			// Check the socket
+				{
+					ESPGuard guard(statelock);
+					s_state *statep = lookup(op.sock);
+
+					if ( !statep || !op.str || op.len < 0 ) {
+						op.error = Invalid;
+						return true;
+					} else if ( statep->disconnected ) {
+						op.error = Disconnected;
+						return true;
+					} else if ( !statep->connected ) {
+						op.error = Invalid;
+						return true;
+					}
+				}
+				op.sent = 0;
+				op.tries = 0;
+				op.phase = 1;
+				break;
+			case 1:			// Send AT+CIPSEND for the next chunk
+				if ( chunk <= 0 ) {
+					op.result = op.sent;
+					return true;
+				}
+				if ( !pace_due() ) {
+					op.phase = 5;
+					return false;
+				}
+				events.clear(EvSendReady|EvSendOk|EvSendFail|EvResp);
+				cipsend(op.sock,chunk);
+				op.phase = 2;
+				return false;
+			case 2:			// Await OK
+				if ( !(ev = events.get() & EvResp) )
+					return false;
+				if ( ev & EvBusy ) {
+					pace_backoff(true);	// Not taken: retry
+					if ( ++op.tries < PaceRetries ) {
+						op.phase = 5;
+						return false;
+					}
+				}
+				if ( !(ev & EvOk) ) {
+					op.error = Fail;
+					return true;
+				}
+				op.tries = 0;
+				op.phase = 3;
+				break;
+			case 3:			// Await ">" and write the chunk
+				if ( !(events.get() & EvSendReady) )
+					return false;
+				for ( int x=0; x<chunk; ++x ) {
+					char b = op.str[op.sent+x];
+
+					if ( capture_cb )
+						capture_cb(op.sock,true,b,capture_arg);
+					io.writeb(b);		// Payload
+				}
+				if ( capture_cb )
+					capture_cb(op.sock,true,-1,capture_arg);	// End of captured segment
+				pace_sent();
+				op.phase = 4;
+				return false;
+			case 4:			// Await SEND OK
+				if ( !(ev = events.get() & (EvSendOk|EvSendFail)) )
+					return false;
+				if ( ev & EvSendFail ) {
+					pace_backoff(true);
+					op.error = Fail;
+					return true;
+				}
+				pace_ok(chunk);
+				op.sent += chunk;
+				op.phase = 1;
+				if ( op.next && op.sent < op.len )
+					return false;	// Let advance() interleave others
+				break;
+			default:		// Paced: await the next send slot
+				if ( !pace_due() )
+					return false;
+				op.phase = 1;
+			}
+		}
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Return the peer of an open socket (used by traffic capture). The
+// ipaddr is returned as 0 when the socket was opened by host name.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::get_peer(int sock,unsigned long& ipaddr,int& port,int& local_port,bool& udp) {
+	ESPGuard guard(statelock);
+	s_state *statep = lookup(sock);
+
+	if ( !statep || !statep->open ) {
+		error = Invalid;
+		return false;
+	}
+
+	ipaddr = statep->raddr;
+	port = statep->rport;
+	local_port = statep->lport;
+	udp = statep->udp;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Return ESP8266 Version Info (only the AT version line is returned)
+//
+// AT+GMR
+// AT version:0.25.0.0(Jun  5 2015 16:27:16)
+// SDK version:1.1.1
+// Ai-Thinker Technology Co. Ltd.
+// Jun 23 2015 23:23:50
+// OK
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::get_version(char *buf,int bufsiz) {
+	s_bufs bufs[] = {
+		{ buf, bufsiz }
+	};
+
+	CmdLock lock(*this,bufs,sizeof bufs / sizeof bufs[0]);
+
+	CMD("AT+GMR");	
+	command("AT+GMR");
+	if ( !waitokfail(CmdIdempotent) ) {
+		*buf = 0;
+		return false;
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// This method returns the name (if any) of the joined Access Point.
+// Optionally, the mac address is also returned (set mac=0 to not
+// allocate a buffer). Finally, the channel and signal strength is
+// returned.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::get_ap_ssid(char *ssid,int ssid_size,char *mac,int mac_size,int& chan,int& db) {
+	// +CWJAP:"NETGEAR67","c0:ff:d4:95:80:04",7,-66
+	char chbuf[6], dbbuf[8], ssidbuf[33], macbuf[18];
+	s_bufs bufs[] = {
+		{ ssid ? ssid : ssidbuf, ssid ? ssid_size : int(sizeof ssidbuf) },
+		{ mac ? mac : macbuf, mac ? mac_size : int(sizeof macbuf) },
+		{ chbuf, sizeof chbuf },
+		{ dbbuf, sizeof dbbuf }
+	};
+
+	CmdLock lock(*this,bufs,sizeof bufs / sizeof bufs[0]);
+
+	if ( bufs[0].bufsiz > 0 && bufs[1].bufsiz > 0 )
+		*bufs[0].buf = *bufs[1].buf = 0;	// Unchanged by "No AP"
+
+	CMD("AT+CWJAP?");
+	command("AT+CWJAP?");
+	
+	if ( !waitokfail(CmdIdempotent) )
+		return false;
+
+	this->channel = chan = str2int(chbuf);
+	this->strength = db = str2int(dbbuf);
+	if ( bufs[0].bufsiz > 0 && bufs[1].bufsiz > 0 && *bufs[1].buf )
+		set_join_bssid(bufs[0].buf,bufs[1].buf);	// For ap_join(...,true)
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Request IP/Gateway and Netmask Info
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::get_ap_info(char *ip,int ipsiz,char *gw,int gwsiz,char *nm,int nmsiz) {
+	s_bufs bufs[] = {
+		{ ip, gwsiz },
+		{ gw, gwsiz },
+		{ nm, nmsiz }
+	};
+	bool ok;
+
+	CmdLock lock(*this,bufs,sizeof bufs / sizeof bufs[0]);
+
+	CMD("AT+CIPAP?");
+	command("AT+CIPAP?");
+	ok = waitokfail(CmdIdempotent);
+
+	if ( !ok ) {
+		if ( ip )
+			*ip = 0;
+		if ( gw )
+			*gw = 0;
+		if ( nm )
+			*nm = 0;
+	}
+
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Request Station IP/Gateway and Netmask Info
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::get_station_info(char *ip,int ipsiz,char *gw,int gwsiz,char *nmask,int nmasksiz) {
+	s_bufs bufs[3] = {
+		{ ip, ipsiz },
+		{ gw, gwsiz },
+		{ nmask, nmasksiz }
+	};
+	bool ok;
+
+	CmdLock lock(*this,bufs,sizeof bufs / sizeof bufs[0]);
+
+	CMD("AT+CIPSTA?");
+	command("AT+CIPSTA?");
+
+	ok = waitokfail(CmdIdempotent);
+	if ( !ok ) {
+		error = Fail;
+		if ( ip )
+			*ip = 0;
+		if ( gw )
+			*gw = 0;
+		if ( nmask )
+			*nmask = 0;
+	}
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set the Access Point IP Address
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::set_ap_addr(const char *ip_addr) {
+	CmdLock lock(*this);
+
+	CMD("AT+CIPAP=...");
+	events.clear(EvResp);
+	write("AT+CIPAP=\"");
+	write(ip_addr);
+	write("\"\r\n");
+
+	return waitokfail(CmdIdempotent);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set the Access Point IP Address
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::set_station_addr(const char *ip_addr) {
+	CmdLock lock(*this);
+
+	CMD("AT+CIPSTA=...");
+	events.clear(EvResp);
+	write("AT+CIPSTA=\"");
+	write(ip_addr);
+	write("\"\r\n");
+
+	return waitokfail(CmdIdempotent);
+}
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::get_ap_mac(char *mac,int macsiz) {
+	s_bufs bufs[] = {
+		{ mac, macsiz }
+	};
+
+	CmdLock lock(*this,bufs,sizeof bufs / sizeof bufs[0]);
+
+	CMD("AT+CIPAPMAC?");
+	command("AT+CIPAPMAC?");
+	return waitokfail(CmdIdempotent);
+}
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::set_ap_mac(const char *mac_addr) {
+	CmdLock lock(*this);
+
+	CMD("AT+CIPAPMAC=...");
+	events.clear(EvResp);
+	write("AT+CIPAPMAC=\"");
+	write(mac_addr);
+	write("\"\r\n");
+
+	return waitokfail(CmdIdempotent);
+}
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::get_station_mac(char *mac,int macsiz) {
+	s_bufs bufs[] = {
+		{ mac, macsiz }
+	};
+
+	CmdLock lock(*this,bufs,sizeof bufs / sizeof bufs[0]);
+
+	CMD("AT+CIPSTAMAC?");
+	command("AT+CIPSTAMAC?");
+	return waitokfail(CmdIdempotent);
+}
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::set_station_mac(const char *mac_addr) {
+	CmdLock lock(*this);
+
+	CMD("AT+CIPSTAMAC=...");
+	events.clear(EvResp);
+	write("AT+CIPSTAMAC=\"");
+	write(mac_addr);
+	write("\"\r\n");
+
+	return waitokfail(CmdIdempotent);
+}
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::get_timeout() {
+	CmdLock lock(*this);
+	
+	CMD("AT+CIPSTO?");
+	command("AT+CIPSTO?");
+
+	if ( !waitokfail(CmdIdempotent) )
+		return -1;
+	return lock.value();
+}
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::set_timeout(int seconds) {
+	CmdLock lock(*this);
+	char buf[16];
+	const char *timeoutstr = int2str(seconds,buf,sizeof buf);
+
+	CMD("AT+CIPSTO=...");
+	events.clear(EvResp);
+	write("AT+CIPSTO=");
+	write(timeoutstr);
+	crlf();
+
+	return waitokfail(CmdIdempotent);
+}
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::get_autoconn() {
+	CmdLock lock(*this);
+	bool rf;
+
+	CMD("AT+CWAUTOCONN?");
+	command("AT+CWAUTOCONN?");
+	rf = waitokfail(CmdIdempotent);
+	if ( !rf ) {
+		error = Fail;
+		return -1;
+	}
+		
+	return lock.value();
+}
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::set_autoconn(bool on) {
+	CmdLock lock(*this);
+
+	CMD("AT+CWAUTOCONN=...");
+	events.clear(EvResp);
+	write("AT+CWAUTOCONN=");
+	write(on ? "1" : "0");
+	crlf();
+	return waitokfail(CmdIdempotent);
+}
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::listen(int port,accept_t accp_cb,void *user) {
+	CmdLock lock(*this);
+	char buf[16];
+	const char *portstr = int2str(port,buf,sizeof buf);
+
+	this->accept_cb = accp_cb;
+	this->accept_arg = user;
+
+	CMD("AT+CIPSERVER=1,..");
+	events.clear(EvResp);
+	write("AT+CIPSERVER=1,");
+	write(portstr);
+	crlf();
+	return waitokfail(CmdIdempotent);
+}
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::accept(int sock,recv_func_t recv_cb,void *user) {
+	ESPGuard guard(statelock);
+	s_state *sockp = lookup(sock);
+
+	if ( sockp ) {
+		sockp->rxcallback = recv_cb;
+		sockp->rxarg = user;
+	}
+}
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::unlisten() {
+	CmdLock lock(*this);
+
+	CMD("AT+CIPSERVER=0");
+	command("AT+CIPSERVER=0");
+	return waitokfail(CmdIdempotent);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Enable/Disable DHCP
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::dhcp(bool on) {
+	CmdLock lock(*this);
+
+	CMD("AT+CWDHCP=2,..");
+	events.clear(EvResp);
+	write("AT+CWDHCP=2,");
+	write(on ? "1" : "0");
+	crlf();
+
+	return waitokfail(CmdIdempotent);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Get the response to AT+CIPMODE?
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::get_cipmode() {
+	CmdLock lock(*this);
+
+	CMD("AT+CIPMODE?");
+	command("AT+CIPMODE?");
+	if ( !waitokfail(CmdIdempotent) ) {
+		error = Fail;
+		return -1;
+	}
+	return lock.value();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Check/set the AT+CIPMODE=n (0 == normal, 1 == "unvarnished")
+//
+// Note:
+//	Setting this option can only be done in certain "modes".
+//	To avoid getting the message:
+//
+//	CIPMUX and CIPSERVER must be 0
+//	ERROR
+//
+//	we check it first. If the mode agrees, we can return ok.
+//	If it differs, then we must make the attempt to set it.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::set_cipmode(int mode) {
+	CmdLock lock(*this);
+
+	if ( get_cipmode() == mode )
+		return true;
+
+	char buf[12];
+	const char *cp = int2str(mode,buf,sizeof buf);
+	CMDX("AT+CIPMODE=");
+	CMD(cp);
+	write("AT+CIPMODE=");
+	command(cp);
+	return waitokfail(CmdIdempotent);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Get the AT+CIPMUX? mode
+// 
+// AT+CIPMUX?
+// +CIPMUX:1
+// OK
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::get_cipmux() {
+	CmdLock lock(*this);
+
+	CMD("AT+CIPMUX?");
+	command("AT+CIPMUX?");
+	if ( !waitokfail(CmdIdempotent) ) {
+		error = Fail;
+		return -1;
+	}
+	return lock.value();
+}
+
+//////////////////////////////////////////////////////////////////////
+// AT+CIPMUX=<mode>
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::set_cipmux(int mode) {
+	CmdLock lock(*this);
+
+	if ( get_cipmux() == mode )	// Avoid setting, if state matches
+		return true;
+
+	char buf[12];
+	const char *cp = int2str(mode,buf,sizeof buf);
+	CMDX("AT+CIPMUX=");
+	CMD(cp);
+	write("AT+CIPMUX=");
+	command(cp);
+	return waitokfail(CmdIdempotent);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Query AP Parameters:
+// AT+CWSAP?
+// +CWSAP:"AI-THINKER_FA205E","",11,0
+// 
+// OK
+// Set:
+// "ssid","pwd",ch,ecn
+// ecn:
+//	0 - Open
+//	1 - WPA_PSK
+//	2 - WPA2_PSK
+//	3 - WPA_WPA2_PSK
+// OK
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+bool
+ESP8266T<N,Io>::query_softap(char *ssid,int ssidsiz,char *pw,int pwsiz,int& ch,AP_Ecn& ecn) {
+	char chbuf[8], ecnbuf[8];
+	struct s_bufs bufs[4] = {
+		{ ssid, ssidsiz },
+		{ pw, pwsiz },
+		{ chbuf, sizeof chbuf },
+		{ ecnbuf, sizeof ecnbuf }
+	};
+	bool ok;
+
+	CmdLock lock(*this,bufs,sizeof bufs / sizeof bufs[0]);
+
+	CMD("AT+CWSAP?");
+	command("AT+CWSAP?");
+
+	ok = waitokfail(CmdIdempotent);
+	if ( ok ) {
+		ch = str2int(chbuf);
+		ecn = AP_Ecn(str2int(ecnbuf));
+	} else	{
+		if ( ssid )
+			*ssid = 0;
+		if ( pw )
+			*pw = 0;
+		ch = -1;
+		ecn = Ecn_Undefined;
+		error = Fail;
+	}
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////
+// List AP's:
+// AT+CWLAP
+// +CWLAP:(2,"england",-74,"d8:eb:97:13:c6:9d",6)
+// +CWLAP:(3,"largeshark2.4",-72,"b4:75:0e:fe:4b:bb",6)
+// +CWLAP:(0,"largeshark-guest",-75,"b6:75:0e:fe:4b:bc",6)
+// +CWLAP:(3,"The Room",-82,"24:a0:74:78:39:9c",11)
+// +CWLAP:(4,"BrownTiger",-77,"c8:d7:19:01:68:53",7)
+// +CWLAP:(3,"NETGEAR67",-57,"c0:ff:d4:95:80:04",11)
+// 
+// OK
+// WIFI DISCONNECT
+// WIFI CONNECTED
+// WIFI GOT IP
+//
+// Each line is parsed as it arrives (no line buffer) and delivered
+// to the caller's table or callback, and copied to the scan cache.
+// Only busy is retried: a repeated scan would report APs twice.
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+int
+ESP8266T<N,Io>::scan(ApInfo *aps,int max,scan_t cb,void *user,unsigned long max_age) {
+	s_scan sc = { aps, max, 0, cb, user };
+	CmdLock lock(*this);
+
+	if ( max_age > 0 && get_scan_age() <= max_age ) {
+		for ( int x = 0; x < scache_n; ++x ) {
+			if ( x < max )
+				aps[x] = scache[x];
+			if ( cb )
+				cb(scache[x],user);
+		}
+		return scache_n;
+	}
+
+	scache_n = scache ? 0 : -1;
+	scanp = &sc;
+
+	CMD("AT+CWLAP");
+	command("AT+CWLAP");
+	bool ok = waitokfail();
+
+	scanp = 0;
+	if ( !ok ) {
+		scache_n = -1;
+		error = Fail;
+		return -1;
+	}
+	scache_t = io.millis();
+	return sc.count;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Deliver one AP of the scan in progress (receive context)
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::scan_found(const ApInfo& ap) {
+	s_scan& sc = *scanp;
+
+	if ( sc.aps && sc.count < sc.max )
+		sc.aps[sc.count] = ap;
+	++sc.count;
+	if ( sc.cb )
+		sc.cb(ap,sc.user);
+	if ( scache && scache_n >= 0 && scache_n < scache_size )
+		scache[scache_n++] = ap;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set the scan cache table (nullptr for none): the last successful
+// scan is kept there (up to size APs), stamped with io.millis()
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+void
+ESP8266T<N,Io>::set_scan_cache(ApInfo *cache,int size) {
+	CmdLock lock(*this);
+
+	scache = cache;
+	scache_size = cache ? size : 0;
+	scache_n = -1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Milliseconds since the cached scan ended, else ~0ul (none, or no
+// clock to tell its age: scan() then always rescans)
+//////////////////////////////////////////////////////////////////////
+
+template <int N,class Io>
+unsigned long
+ESP8266T<N,Io>::get_scan_age() {
+
+	if ( !scache || scache_n < 0 || !io.has_clock() )
+		return ~0ul;
+	return io.millis() - scache_t;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Quit AP:
+// AT+CWQAP
+//
+// OK
+//////////////////////////////////////////////////////////////////////
+
+#undef DBG
+#undef RX
+#undef CMD
+#undef CMDX
+#undef CMDC
+
+#endif // ESP8266_IMPL_HPP
+
+// End esp8266_impl.hpp
@@ -0,0 +1,377 @@
+///////////////////////////////////////////////////////////////////////
+// espbond.cpp -- Bonded uplink striped across several ESP8266 modules
+// Date: Sun Oct 18 16:05:18 2026
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include "espbond.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Constructor
+//////////////////////////////////////////////////////////////////////
+
+ESPBond::ESPBond()
+	: nlinks(0), session(0), next_seq(0), timeout_ms(5000),
+	  data(0), nchunks(0), seq0(0), state(0), base(0), ndone(0), bytes(0) {
+	pthread_mutex_init(&mutex,0);
+	pthread_cond_init(&cond,0);
+}
+
+ESPBond::~ESPBond() {
+
+	// Join the workers of stuck links (cancelled by the watchdog)
+	for ( int x=0; x<nlinks; ++x ) {
+		s_link& link = links[x];
+
+		if ( link.running ) {
+			link.esp->cancel();
+			pthread_join(link.thread,0);
+			link.running = false;
+		}
+	}
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Monotonic time in microseconds
+//////////////////////////////////////////////////////////////////////
+
+unsigned long
+ESPBond::now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Add a module as a link (before connect())
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPBond::add(ESP8266& esp) {
+
+	if ( nlinks >= MaxLinks )
+		return false;
+
+	s_link& link = links[nlinks++];
+
+	memset(&link,0,sizeof link);
+	link.bond = this;
+	link.esp = &esp;
+	link.sock = -1;
+	link.chunk = -1;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write one chunk header + data as a single CIPSEND
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPBond::write_hdr(s_link& link,unsigned flags,unsigned long seq,const char *data,int len) {
+	char buf[HdrSize+ChunkSize];
+
+	buf[0] = 'E';
+	buf[1] = 'B';
+	buf[2] = flags;
+	buf[3] = 0;
+	buf[4] = seq >> 24;
+	buf[5] = seq >> 16;
+	buf[6] = seq >> 8;
+	buf[7] = seq;
+	buf[8] = len >> 8;
+	buf[9] = len;
+	buf[10] = buf[11] = 0;
+	if ( len > 0 )
+		memcpy(buf+HdrSize,data,len);
+
+	return link.esp->write(link.sock,buf,HdrSize+len) == HdrSize+len;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Open one TCP connection per link, each announcing the session
+//////////////////////////////////////////////////////////////////////
+
+int
+ESPBond::connect(const char *host,int port) {
+	int nup = 0;
+
+	session = (now_us() ^ (unsigned long)getpid()) & 0xFFFFFFFFul;
+	next_seq = 0;
+
+	for ( int x=0; x<nlinks; ++x ) {
+		s_link& link = links[x];
+
+		link.sock = link.esp->tcp_connect(host,port,0);
+		link.up = link.sock >= 0 && write_hdr(link,Hello,session,0,0);
+		if ( link.up )
+			++nup;
+		else	++link.failures;
+	}
+	return nup;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Count usable links (mutex held)
+//////////////////////////////////////////////////////////////////////
+
+int
+ESPBond::uplinks() const {
+	int n = 0;
+
+	for ( int x=0; x<nlinks; ++x )
+		if ( links[x].up )
+			++n;
+	return n;
+}
+
+unsigned long
+ESPBond::best_latency() const {
+	unsigned long best = 0;
+
+	for ( int x=0; x<nlinks; ++x ) {
+		const s_link& link = links[x];
+
+		if ( link.up && link.latency_us && (!best || link.latency_us < best) )
+			best = link.latency_us;
+	}
+	return best;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Choose the next chunk for link (mutex held). Returns the chunk
+// index, -1 if the link should wait, or -2 when the send is over.
+//////////////////////////////////////////////////////////////////////
+
+long
+ESPBond::take(s_link& link) {
+	long cx, end, pending = 0;
+
+	if ( ndone >= nchunks || !link.up )
+		return -2;
+
+	end = base + Window < nchunks ? base + Window : nchunks;
+	for ( cx=base; cx<end && state[cx] != 0; ++cx )
+		;
+	if ( cx >= end )
+		return -1;			// Nothing in the window
+
+	for ( long x=cx; x<nchunks; ++x )
+		if ( !state[x] )
+			++pending;
+
+	// Near the end, leave the remaining chunks to the faster links
+	if ( pending < uplinks() ) {
+		unsigned long best = best_latency();
+
+		if ( best && link.latency_us > best * 2 )
+			return -1;
+	}
+	return cx;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Link worker thread
+//////////////////////////////////////////////////////////////////////
+
+void *
+ESPBond::worker(void *arg) {
+	s_link& link = *(s_link *)arg;
+	ESPBond& bond = *link.bond;
+	char buf[ChunkSize];
+	long cx;
+
+	pthread_mutex_lock(&bond.mutex);
+
+	for (;;) {
+		cx = bond.take(link);
+		if ( cx == -2 )
+			break;
+		if ( cx == -1 ) {
+			pthread_cond_wait(&bond.cond,&bond.mutex);
+			continue;
+		}
+
+		// Copy the chunk, since a stuck write may outlive send()
+		long off = cx * ChunkSize;
+		int len = bond.bytes - off < ChunkSize ? int(bond.bytes - off) : int(ChunkSize);
+		unsigned long seq = bond.seq0 + cx;
+
+		memcpy(buf,bond.data+off,len);
+		bond.state[cx] = 1;
+		link.busy = true;
+		link.chunk = cx;
+		link.t0_us = now_us();
+		pthread_mutex_unlock(&bond.mutex);
+
+		bool ok = bond.write_hdr(link,0,seq,buf,len);
+		unsigned long t = now_us() - link.t0_us;
+
+		pthread_mutex_lock(&bond.mutex);
+		if ( link.stuck )
+			break;			// The watchdog gave up on this link
+
+		link.busy = false;
+		link.chunk = -1;
+
+		if ( ok ) {
+			bond.state[cx] = 2;
+			++bond.ndone;
+			while ( bond.base < bond.nchunks && bond.state[bond.base] == 2 )
+				++bond.base;
+			++link.chunks;
+			link.bytes += len;
+			if ( link.latency_us )
+				link.latency_us = link.latency_us - link.latency_us / 8 + t / 8;
+			else	link.latency_us = t;
+		} else	{
+			bond.state[cx] = 0;	// Send it over another link
+			link.up = false;
+			++link.failures;
+		}
+		pthread_cond_broadcast(&bond.cond);
+	}
+
+	pthread_mutex_unlock(&bond.mutex);
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Send data striped over the links. Returns bytes, else -1 if all
+// links failed.
+//////////////////////////////////////////////////////////////////////
+
+long
+ESPBond::send(const char *data,long bytes) {
+	bool ok;
+
+	if ( bytes <= 0 )
+		return 0;
+
+	pthread_mutex_lock(&mutex);
+
+	this->data = data;
+	this->bytes = bytes;
+	nchunks = (bytes + ChunkSize - 1) / ChunkSize;
+	seq0 = next_seq;
+	state = new unsigned char[nchunks];
+	memset(state,0,nchunks);
+	base = ndone = 0;
+
+	for ( int x=0; x<nlinks; ++x ) {
+		s_link& link = links[x];
+
+		link.running = link.up && !link.stuck
+			&& pthread_create(&link.thread,0,worker,&link) == 0;
+	}
+
+	// Watchdog: wait for completion or for all links to fail
+	while ( ndone < nchunks && uplinks() > 0 ) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME,&ts);
+		ts.tv_nsec += 100000000l;
+		if ( ts.tv_nsec >= 1000000000l ) {
+			++ts.tv_sec;
+			ts.tv_nsec -= 1000000000l;
+		}
+		pthread_cond_timedwait(&cond,&mutex,&ts);
+
+		unsigned long t = now_us();
+
+		for ( int x=0; x<nlinks; ++x ) {
+			s_link& link = links[x];
+
+			if ( link.up && link.busy && t - link.t0_us > timeout_ms * 1000ul ) {
+				link.up = false;	// Module stopped answering
+				link.stuck = true;
+				link.esp->cancel();	// Unblock its worker
+				link.busy = false;
+				++link.failures;
+				state[link.chunk] = 0;
+				link.chunk = -1;
+				pthread_cond_broadcast(&cond);
+			}
+		}
+	}
+
+	ok = ndone >= nchunks;
+	if ( ok )
+		next_seq += nchunks;
+	else	nchunks = ndone;	// Stop the workers
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+
+	for ( int x=0; x<nlinks; ++x ) {
+		s_link& link = links[x];
+
+		if ( link.running && !link.stuck ) {
+			pthread_join(link.thread,0);
+			link.running = false;
+		}
+	}
+
+	pthread_mutex_lock(&mutex);
+	delete[] state;
+	state = 0;
+	this->data = 0;
+	pthread_mutex_unlock(&mutex);
+
+	return ok ? bytes : -1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Announce the end of the stream and close the links
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPBond::finish() {
+	bool ok = false;
+
+	for ( int x=0; x<nlinks; ++x ) {
+		s_link& link = links[x];
+
+		if ( !ok && link.up && !link.stuck )
+			ok = write_hdr(link,End,next_seq,0,0);
+	}
+
+	for ( int x=0; x<nlinks; ++x ) {
+		s_link& link = links[x];
+
+		if ( link.sock >= 0 && !link.stuck )
+			link.esp->close(link.sock);
+		link.sock = -1;
+		link.up = false;
+	}
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Link statistics
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPBond::get_stats(int lx,LinkStats& stats) {
+
+	if ( lx < 0 || lx >= nlinks )
+		return false;
+
+	pthread_mutex_lock(&mutex);
+	const s_link& link = links[lx];
+	stats.up = link.up;
+	stats.chunks = link.chunks;
+	stats.bytes = link.bytes;
+	stats.failures = link.failures;
+	stats.latency_us = link.latency_us;
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+// End espbond.cpp
@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////////////
+// espbond.hpp -- Bonded uplink striped across several ESP8266 modules
+// Date: Sun Oct 18 16:05:18 2026
+///////////////////////////////////////////////////////////////////////
+//
+// ESPBond opens one TCP connection per module to the same server and
+// splits send() data into sequenced chunks. Each link runs in its own
+// POSIX thread and takes the next chunk when it is free, so faster
+// links carry more of the load. Near the end of a transfer, links
+// whose measured send latency is much worse than the best link stop
+// taking chunks, so one slow module does not hold up completion.
+//
+// A link that fails a write, or does not complete one within the
+// watchdog timeout, is marked down and its chunk is sent again over
+// another link. The watchdog cancels the stuck module's command (see
+// ESP8266::cancel()), so that its worker returns; send() does not wait
+// for it, but the destructor joins it. See bondsrv.cpp for the
+// reassembling server.
+//
+// Each chunk is sent as a 12 byte header followed by its data:
+//
+//	0	'E','B'		Magic
+//	2	flags		Hello, End (see below)
+//	3	0		Reserved
+//	4	seq		Sequence number (big endian)
+//	8	len		Data length (big endian)
+//	10	0,0		Reserved
+//
+// Hello chunks carry the session id in seq, and End chunks carry the
+// total number of data chunks.
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef ESPBOND_HPP
+#define ESPBOND_HPP
+
+#include <pthread.h>
+
+#include "esp8266.hpp"
+
+class ESPBond {
+public:
+	enum {
+		MaxLinks = 16,
+		HdrSize = 12,			// Chunk header size
+		ChunkSize = 1024,		// Data bytes per chunk
+		Window = 64			// Max chunks ahead of the oldest unsent
+	};
+
+	enum Flags {
+		Hello = 0x01,			// First chunk on a link (seq=session)
+		End = 0x02			// Stream end (seq=chunk count)
+	};
+
+	struct LinkStats {
+		bool		up;		// Link is usable
+		unsigned long	chunks;		// Chunks sent
+		unsigned long	bytes;		// Data bytes sent
+		unsigned long	failures;	// Failed or timed out writes
+		unsigned long	latency_us;	// Smoothed send latency
+	};
+
+private:
+	struct s_link {
+		ESPBond		*bond;		// Owner
+		ESP8266		*esp;		// Module
+		int		sock;		// Connection, else -1
+		bool		up;		// Usable
+		bool		busy;		// Write in progress
+		bool		stuck;		// Write abandoned by the watchdog
+		bool		running;	// Worker started and not yet joined
+		long		chunk;		// Chunk being sent, else -1
+		unsigned long	t0_us;		// Start of current write
+		unsigned long	latency_us;	// Smoothed (EWMA 1/8) send latency
+		unsigned long	chunks;		// Chunks sent
+		unsigned long	bytes;		// Data bytes sent
+		unsigned long	failures;	// Failures
+		pthread_t	thread;		// Worker
+	};
+
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+
+	s_link		links[MaxLinks];
+	int		nlinks;
+	unsigned long	session;		// Session id
+	unsigned long	next_seq;		// Next chunk sequence number (stream wide)
+	unsigned long	timeout_ms;		// Watchdog timeout
+
+	// The current send() call:
+	const char	*data;			// Caller's data
+	long		nchunks;		// Chunks in this call
+	unsigned long	seq0;			// Sequence number of chunk 0
+	unsigned char	*state;			// Per chunk: 0=pending, 1=sending, 2=done
+	long		base;			// Oldest chunk not done
+	long		ndone;			// Chunks done
+	long		bytes;			// Bytes in this call
+
+	static unsigned long now_us();
+	static void *worker(void *arg);
+
+	int uplinks() const;			// Links up (mutex held)
+	unsigned long best_latency() const;	// Best latency of up links (mutex held)
+	long take(s_link& link);		// Pick a chunk for link (mutex held)
+	bool write_hdr(s_link& link,unsigned flags,unsigned long seq,const char *data,int len);
+
+public:	ESPBond();
+	~ESPBond();
+
+	bool add(ESP8266& esp);			// Add a module as a link
+	inline int count() const		{ return nlinks; }
+	inline void set_timeout(unsigned long ms) { timeout_ms = ms; }
+
+	int connect(const char *host,int port);	// Returns links connected
+	long send(const char *data,long bytes);	// Returns bytes sent, else -1
+	bool finish();				// Send End and close links
+
+	bool get_stats(int lx,LinkStats& stats);
+};
+
+#endif // ESPBOND_HPP
+
+// End espbond.hpp
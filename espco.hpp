@@ -0,0 +1,225 @@
+///////////////////////////////////////////////////////////////////////
+// espco.hpp -- C++20 coroutine API over the ESP8266 class
+// Date: Sun Oct 18 19:24:37 2026
+///////////////////////////////////////////////////////////////////////
+//
+// ESPCo lets coroutines co_await ESP8266 operations, so that one
+// thread (or MCU main loop) can run many flows on one module, each
+// needing only its coroutine frame rather than a whole stack:
+//
+//	ESPTask flow(ESPCo<ESP8266>& co,const char *host) {
+//		int sock = co_await co.connect(host,80);
+//		co_await co.send(sock,"GET /\r\n",7);
+//		while ( (n = co_await co.recv(sock,buf,sizeof buf)) > 0 )
+//			...
+//		co_await co.close(sock);
+//	}
+//
+//	flow(co,"a.example"); flow(co,"b.example");
+//	co.run();				// Until all flows return
+//
+// connect(), send(), close() and command() are submitted to the
+// ESP8266 asynchronous operation queue (ESP8266T::submit()), and the
+// coroutine resumes from run() when its operation completes. recv()
+// resumes once the socket has buffered data, or was closed. Results
+// are as for the blocking calls (-1 on failure, see get_error()).
+//
+// Compile with -std=c++20. Not for use with the blocking sync
+// backends' receiver thread: run() must be the only caller.
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef ESPCO_HPP
+#define ESPCO_HPP
+
+#include <stdlib.h>
+#include <coroutine>
+
+#include "esp8266.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Coroutine return type: starts at once, frees its frame on return
+//////////////////////////////////////////////////////////////////////
+
+struct ESPTask {
+	struct promise_type {
+		promise_type()				{ ++active(); }
+		~promise_type()				{ --active(); }
+
+		ESPTask get_return_object()		{ return ESPTask(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void()			{ }
+		void unhandled_exception()		{ abort(); }
+	};
+
+	static int& active()			{ static int n = 0; return n; }	// Tasks not yet returned
+};
+
+//////////////////////////////////////////////////////////////////////
+// Awaitable operations for an ESP8266T<> (Esp), with RxSize bytes of
+// receive buffering for each socket
+//////////////////////////////////////////////////////////////////////
+
+template <class Esp,int RxSize=256>
+class ESPCo {
+	typedef typename Esp::AsyncOp AsyncOp;
+
+	struct s_rx {
+		char		buf[RxSize];	// Received data
+		unsigned	head;		// Next byte in
+		unsigned	tail;		// Next byte out
+		bool		udp;		// UDP socket (-1 ends datagram, not stream)
+		bool		closed;		// Remote closed
+		std::coroutine_handle<> waiter;	// recv() awaiting data, else null
+	};
+
+	Esp&		esp;
+	s_rx		rx[Esp::Connections];
+	unsigned long	drops;			// Bytes lost to full buffers
+
+	static void rx_cb(int sock,int ch,void *user) {
+		ESPCo& co = *(ESPCo *)user;
+		s_rx& r = co.rx[sock];
+
+		if ( ch == -1 ) {
+			if ( !r.udp )
+				r.closed = true;
+		} else if ( r.head - r.tail < unsigned(RxSize) )
+			r.buf[r.head++ % RxSize] = ch;
+		else	++co.drops;
+	}
+
+	static void resume(AsyncOp& op,void *user) {
+		std::coroutine_handle<>::from_address(user).resume();
+	}
+
+	// Awaits completion of a submitted operation
+	struct OpAwait {
+		ESPCo&		co;
+		AsyncOp		op;
+
+		OpAwait(ESPCo& co,typename Esp::OpKind kind) : co(co), op() {
+			op.kind = kind;
+			op.lport = -1;
+		}
+		bool await_ready() const noexcept	{ return false; }
+		void await_suspend(std::coroutine_handle<> h) {
+			op.done = resume;
+			op.user = h.address();
+			co.esp.submit(op);
+		}
+		int await_resume() {
+			if ( op.kind == Esp::OpConnect && op.result >= 0 )
+				co.reset(op.result,op.udp);
+			return op.result;
+		}
+	};
+
+	// Awaits received data (or close)
+	struct RecvAwait {
+		ESPCo&		co;
+		int		sock;
+		char		*buf;
+		int		bytes;
+
+		bool await_ready() const noexcept {
+			if ( sock < 0 || sock >= Esp::Connections )
+				return true;
+			const s_rx& r = co.rx[sock];
+			return r.head != r.tail || r.closed;
+		}
+		void await_suspend(std::coroutine_handle<> h) { co.rx[sock].waiter = h; }
+		int await_resume() {
+			if ( sock < 0 || sock >= Esp::Connections || bytes < 0 )
+				return -1;
+
+			s_rx& r = co.rx[sock];
+			int n = 0;
+
+			while ( n < bytes && r.tail != r.head )
+				buf[n++] = r.buf[r.tail++ % RxSize];
+			return n;			// 0 when closed
+		}
+	};
+
+	void reset(int sock,bool udp) {
+		s_rx& r = rx[sock];
+
+		r.head = r.tail = 0;
+		r.udp = udp;
+		r.closed = false;
+		r.waiter = nullptr;
+	}
+
+public:	ESPCo(Esp& esp) : esp(esp), drops(0) {
+		for ( int x=0; x<Esp::Connections; ++x )
+			reset(x,false);
+	}
+
+	inline Esp& get_esp()			{ return esp; }
+	inline unsigned long get_drops() const	{ return drops; }
+
+	OpAwait connect(const char *host,int port) {		// TCP: socket, else -1
+		OpAwait a(*this,Esp::OpConnect);
+		a.op.sock = -1;			// Allocated when started
+		a.op.str = host;
+		a.op.len = port;
+		a.op.rx_cb = rx_cb;
+		a.op.rx_user = this;
+		return a;
+	}
+	OpAwait udp(const char *host,int port,int local_port=-1) { // UDP: socket, else -1
+		OpAwait a = connect(host,port);
+		a.op.udp = true;
+		a.op.lport = local_port;
+		return a;
+	}
+	OpAwait send(int sock,const char *data,int bytes) {	// Bytes sent, else -1
+		OpAwait a(*this,Esp::OpSend);
+		a.op.sock = sock;
+		a.op.str = data;
+		a.op.len = bytes;
+		return a;
+	}
+	OpAwait close(int sock) {				// 1 if closed, else -1
+		OpAwait a(*this,Esp::OpClose);
+		a.op.sock = sock;
+		return a;
+	}
+	OpAwait command(const char *cmd) {			// 1 if OK, else -1
+		OpAwait a(*this,Esp::OpCommand);
+		a.op.str = cmd;
+		return a;
+	}
+	RecvAwait recv(int sock,char *buf,int bytes) {		// Bytes read, 0 if closed, else -1
+		return RecvAwait{*this,sock,buf,bytes};
+	}
+
+	// Receive, progress operations and resume coroutines (once)
+	void poll() {
+		esp.receive();
+		esp.dispatch();
+		esp.advance();
+
+		for ( int x=0; x<Esp::Connections; ++x ) {
+			s_rx& r = rx[x];
+
+			if ( r.waiter && (r.head != r.tail || r.closed) ) {
+				std::coroutine_handle<> h = r.waiter;
+
+				r.waiter = nullptr;
+				h.resume();
+			}
+		}
+	}
+
+	void run() {						// Poll until all ESPTasks return
+		while ( ESPTask::active() > 0 )
+			poll();
+	}
+};
+
+#endif // ESPCO_HPP
+
+// End espco.hpp
@@ -0,0 +1,276 @@
+///////////////////////////////////////////////////////////////////////
+// especho.cpp -- Echo server using ESP8266 poll() and recv()
+// Date: Sun Oct 18 20:32:48 2026
+///////////////////////////////////////////////////////////////////////
+//
+// Listens on the -L port and echoes whatever each client sends, in
+// the style of a BSD poll(2) loop: accepted sockets are given no
+// receive callback, so their data is buffered for recv(), and one
+// poll() call watches all of them.
+//
+// With -e, a Linux epoll(7) loop is used instead: it waits on the
+// serial device and on an eventfd per socket (see espfd.hpp), as a
+// daemon mixing ESP8266 and native sockets would.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+
+#include "esp8266.hpp"
+#include "espserial.hpp"
+#include "espfd.hpp"
+
+static int opt_baudrate = 115200;
+static int opt_listen = 7;
+static bool opt_probe = false;
+static bool opt_verbose = false;
+static bool opt_epoll = false;
+static const char *opt_device = "/dev/cu.usbserial-A50285BI";
+
+static ESP8266::PollFd fds[N_CONNECTION];
+static int nfds = 0;
+
+//////////////////////////////////////////////////////////////////////
+// Accept callback: add the socket to the poll set
+//////////////////////////////////////////////////////////////////////
+
+static void
+accept_cb(int sock,void *arg) {
+
+	if ( sock < 0 || nfds >= N_CONNECTION )
+		return;
+
+	if ( opt_verbose )
+		printf("Accepted sock %d\n",sock);
+
+	fds[nfds].sock = sock;
+	fds[nfds].events = ESP8266::PollIn;
+	fds[nfds].revents = 0;
+	++nfds;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Echo the data buffered for sock
+//////////////////////////////////////////////////////////////////////
+
+static void
+echo(ESP8266& esp,int sock) {
+	char buf[256];
+	int n;
+
+	while ( (n = esp.recv(sock,buf,sizeof buf)) > 0 ) {
+		if ( opt_verbose )
+			printf("sock %d: echo %d bytes\n",sock,n);
+		if ( esp.write(sock,buf,n) != n )
+			break;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Serve with ESP8266::poll()
+//////////////////////////////////////////////////////////////////////
+
+static void
+poll_loop(ESP8266& esp) {
+
+	for (;;) {
+		if ( esp.poll(fds,nfds,1000) <= 0 )
+			continue;
+
+		for ( int x=0; x<nfds; ++x ) {
+			ESP8266::PollFd& fd = fds[x];
+
+			if ( fd.revents & ESP8266::PollIn )
+				echo(esp,fd.sock);
+
+			if ( fd.revents & (ESP8266::PollHup|ESP8266::PollErr|ESP8266::PollNval) ) {
+				if ( opt_verbose )
+					printf("sock %d: closed\n",fd.sock);
+				esp.close(fd.sock);
+				fds[x--] = fds[--nfds];		// Remove from the poll set
+			}
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Serve with epoll(7), on the serial device and socket eventfds
+//////////////////////////////////////////////////////////////////////
+
+static void
+epoll_loop(ESP8266& esp,ESPSerial& serial) {
+	struct epoll_event ev, evs[N_CONNECTION+1];
+	ESPEventFd efds;
+	int efd, n;
+
+	if ( (efd = epoll_create1(EPOLL_CLOEXEC)) == -1 || !efds.open(N_CONNECTION) ) {
+		fprintf(stderr,"%s: creating epoll/eventfd descriptors\n",strerror(errno));
+		exit(5);
+	}
+
+	esp.set_notify(ESPEventFd::notify,&efds);
+	serial.set_idle_wait(0);			// receive() must not block
+
+	memset(&ev,0,sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.u32 = N_CONNECTION;			// The serial device
+	epoll_ctl(efd,EPOLL_CTL_ADD,serial.get_fd(),&ev);
+
+	for ( int sock=0; sock<N_CONNECTION; ++sock ) {
+		ev.data.u32 = sock;
+		epoll_ctl(efd,EPOLL_CTL_ADD,efds.get_fd(sock),&ev);
+	}
+
+	for (;;) {
+		if ( (n = epoll_wait(efd,evs,N_CONNECTION+1,-1)) == -1 && errno != EINTR ) {
+			fprintf(stderr,"%s: epoll_wait()\n",strerror(errno));
+			exit(5);
+		}
+
+		for ( int x=0; x<n; ++x ) {
+			int sock = evs[x].data.u32;
+
+			if ( sock == N_CONNECTION ) {
+				esp.receive();
+				continue;
+			}
+
+			short events = efds.take(sock);
+
+			if ( events & ESP8266::PollIn )
+				echo(esp,sock);
+
+			if ( events & (ESP8266::PollHup|ESP8266::PollErr) ) {
+				if ( opt_verbose )
+					printf("sock %d: closed\n",sock);
+				esp.close(sock);
+			}
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Command line usage
+//////////////////////////////////////////////////////////////////////
+
+static void
+usage(const char *cmd) {
+	const char *cp = strrchr(cmd,'/');
+
+	if ( cp )
+		cmd = cp + 1;
+
+	fprintf(stderr,
+		"Usage: %s [-b baudrate] [-d device] [-L port] [-e] [-B] [-v] [-h]\n"
+		"where options include:\n"
+		"\t-b baudrate\tSerial baud rate (115200)\n"
+		"\t-d device\tSerial device pathname\n"
+		"\t-L port\t\tPort to listen on (7)\n"
+		"\t-e\t\tUse an epoll loop with eventfds\n"
+		"\t-B\t\tFind the module's baud rate, then raise it\n"
+		"\t-v\t\tVerbose output mode\n"
+		"\t-h\t\tThis help info.\n",
+		cmd);
+	exit(0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Serve until interrupted
+//////////////////////////////////////////////////////////////////////
+
+int
+main(int argc,char **argv) {
+	static const char options[] = ":b:d:L:eBvh";
+	static char rxbufs[N_CONNECTION*512];
+	int optch, er = 0;
+
+	while ( (optch = getopt(argc,argv,options)) != -1 ) {
+		switch ( optch ) {
+		case 'b':
+			opt_baudrate = atoi(optarg);
+			break;
+		case 'd':
+			opt_device = optarg;
+			break;
+		case 'L':
+			opt_listen = atoi(optarg);
+			break;
+		case 'e':
+			opt_epoll = true;
+			break;
+		case 'B':
+			opt_probe = true;
+			break;
+		case 'v':
+			opt_verbose = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			break;
+		case ':':
+			fprintf(stderr,"Missing argument for -%c\n",optopt);
+			++er;
+			break;
+		default:
+			fprintf(stderr,"Invalid option -%c\n",optopt);
+			++er;
+		}
+	}
+
+	if ( er > 0 ) {
+		fprintf(stderr,"Use option -h for more information.\n");
+		exit(1);
+	}
+
+	ESPSerial serial;
+
+	if ( !serial.open(opt_device,opt_baudrate) ) {
+		fprintf(stderr,"%s: Opening serial device %s for r/w\n",
+			strerror(errno),
+			opt_device);
+		exit(3);
+	}
+
+	if ( opt_probe ) {
+		unsigned long t0 = ESPSerial::millis(0);
+
+		if ( !serial.probe_baud(true) ) {
+			fprintf(stderr,"No response from %s at any baud rate\n",opt_device);
+			exit(3);
+		}
+		if ( opt_verbose )
+			printf("Module at %d baud (probed in %lu ms)\n",
+				serial.get_baudrate(),ESPSerial::millis(0) - t0);
+	}
+
+	ESP8266 esp(ESPSerial::writeb,ESPSerial::readb,ESPSerial::rpoll,ESPSerial::idle,&serial);
+
+	esp.get_io().set_clock(ESPSerial::millis);
+	esp.set_rx_buffers(rxbufs,sizeof rxbufs);
+
+	if ( !esp.start() ) {
+		fprintf(stderr,"Unable to start ESP8266\n");
+		exit(3);
+	}
+
+	if ( !esp.listen(opt_listen,accept_cb) ) {
+		fprintf(stderr,"Listen on port %d failed.\n",opt_listen);
+		exit(4);
+	}
+
+	if ( opt_verbose )
+		printf("Listening on port %d..\n",opt_listen);
+
+	if ( opt_epoll )
+		epoll_loop(esp,serial);
+	else	poll_loop(esp);
+
+	return 0;
+}
+
+// End especho.cpp
@@ -0,0 +1,120 @@
+///////////////////////////////////////////////////////////////////////
+// espfd.cpp -- File descriptor per ESP8266 socket, for host event loops
+// Date: Sun Oct 18 20:58:14 2026
+///////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "espfd.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Constructor
+//////////////////////////////////////////////////////////////////////
+
+ESPEventFd::ESPEventFd() : nsocks(0) {
+
+	for ( int x=0; x<MaxSockets; ++x ) {
+		rfd[x] = wfd[x] = -1;
+		pending[x] = 0;
+	}
+}
+
+ESPEventFd::~ESPEventFd() {
+	close();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Create the descriptors (non-blocking, close on exec)
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPEventFd::open(int nsocks) {
+
+	if ( this->nsocks > 0 || nsocks < 1 || nsocks > MaxSockets )
+		return false;
+
+	for ( int x=0; x<nsocks; ++x ) {
+#ifdef __linux__
+		rfd[x] = wfd[x] = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+		if ( rfd[x] == -1 )
+			break;
+#else
+		int fds[2];
+
+		if ( pipe(fds) == -1 )
+			break;
+		for ( int y=0; y<2; ++y ) {
+			fcntl(fds[y],F_SETFL,fcntl(fds[y],F_GETFL) | O_NONBLOCK);
+			fcntl(fds[y],F_SETFD,FD_CLOEXEC);
+		}
+		rfd[x] = fds[0];
+		wfd[x] = fds[1];
+#endif
+		pending[x] = 0;
+		this->nsocks = x + 1;
+	}
+
+	if ( this->nsocks < nsocks ) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Close all descriptors
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPEventFd::close() {
+
+	for ( int x=0; x<nsocks; ++x ) {
+		if ( wfd[x] != rfd[x] )
+			::close(wfd[x]);
+		::close(rfd[x]);
+		rfd[x] = wfd[x] = -1;
+	}
+	nsocks = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Drain the descriptor, and return the events noted since last time
+//////////////////////////////////////////////////////////////////////
+
+short
+ESPEventFd::take(int sock) {
+	char buf[64];
+
+	if ( sock < 0 || sock >= nsocks )
+		return 0;
+
+	while ( read(rfd[sock],buf,sizeof buf) > 0 )
+		;				// eventfd reads 8 bytes at once
+	return __atomic_exchange_n(&pending[sock],0,__ATOMIC_ACQ_REL);
+}
+
+//////////////////////////////////////////////////////////////////////
+// ESP8266 notify hook: note the events, and make the fd readable
+// (only written when no events were pending, so it can never fill)
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPEventFd::notify(int sock,short events,void *user) {
+	ESPEventFd& efds = *(ESPEventFd *)user;
+	uint64_t one = 1;
+
+	if ( sock < 0 || sock >= efds.nsocks )
+		return;
+
+	if ( !__atomic_fetch_or(&efds.pending[sock],events,__ATOMIC_ACQ_REL) ) {
+		ssize_t rc = write(efds.wfd[sock],&one,sizeof one);
+		(void)rc;			// EAGAIN: already readable
+	}
+}
+
+// End espfd.cpp
@@ -0,0 +1,52 @@
+///////////////////////////////////////////////////////////////////////
+// espfd.hpp -- File descriptor per ESP8266 socket, for host event loops
+// Date: Sun Oct 18 20:58:14 2026
+///////////////////////////////////////////////////////////////////////
+//
+// ESPEventFd gives each ESP8266 socket a file descriptor (an eventfd
+// on Linux, else a pipe) that becomes readable when the socket has
+// news: data, accept/connect, remote close or connect failure. Add
+// these, and the serial device, to an epoll/poll/libevent loop:
+//
+//	ESPEventFd efds;
+//	efds.open(N_CONNECTION);
+//	esp.set_notify(ESPEventFd::notify,&efds);
+//
+//	serial fd readable:	esp.receive();
+//	efds.get_fd(s) readable: ev = efds.take(s); then esp.recv(s,..)
+//
+// notify() may run in the ESP8266 receiver thread; take() may run in
+// any one other thread.
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef ESPFD_HPP
+#define ESPFD_HPP
+
+class ESPEventFd {
+public:
+	enum {
+		MaxSockets = 16
+	};
+
+private:
+	int		rfd[MaxSockets];	// Read side (the eventfd), else -1
+	int		wfd[MaxSockets];	// Write side (same as rfd for eventfd)
+	short		pending[MaxSockets];	// PollEvent bits not yet taken
+	int		nsocks;			// Sockets opened
+
+public:	ESPEventFd();
+	~ESPEventFd();
+
+	bool open(int nsocks);			// Create a descriptor for sockets 0..nsocks-1
+	void close();
+
+	inline int get_fd(int sock) const	{ return sock >= 0 && sock < nsocks ? rfd[sock] : -1; }
+	short take(int sock);			// Clear readability, returning the events
+
+	static void notify(int sock,short events,void *user);	// ESP8266 notify hook (user is the ESPEventFd *)
+};
+
+#endif // ESPFD_HPP
+
+// End espfd.hpp
@@ -0,0 +1,347 @@
+///////////////////////////////////////////////////////////////////////
+// espgw.cpp -- Gateway: many ESP8266 modules served by one process
+// Date: Sun Oct 18 15:10:33 2026
+///////////////////////////////////////////////////////////////////////
+//
+// Each -d option adds one module to an ESPManager. Every module is
+// started, and optionally listens on the -L port. Received bytes are
+// counted per module, and manager statistics are reported every -i
+// seconds until interrupted (^C).
+//
+// The modules are started together: the start commands are queued as
+// asynchronous operations, so a slow module does not hold up the rest.
+//
+// With -c host:port, each started module also connects to host:port
+// asynchronously. A busy answer is retried after a backoff (-r sets
+// the attempts), which the manager's timer drives with no further
+// input from the module.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include "espmgr.hpp"
+
+enum {
+	StartOps = 5,			// ATE0, CIPSERVER=0, CIPMODE, CIPMUX, CIPSERVER
+	StartSecs = 10			// Time allowed for all modules to start
+};
+
+static int opt_baudrate = 115200;
+static int opt_listen = -1;
+static int opt_interval = 10;
+static char opt_host[64];
+static int opt_port = -1;
+static int opt_retry = 0;
+static bool opt_probe = false;
+static bool opt_verbose = false;
+
+static volatile bool stop = false;
+
+// A module left listening refuses AT+CIPMUX, so stop its server first.
+// This fails when no server is running, which is not an error.
+static const char unlisten[] = "AT+CIPSERVER=0";
+
+struct s_gwmod {
+	ESP8266		*esp;		// Module's ESP8266
+	int		mx;		// Module index
+	unsigned long	bytes;		// Payload bytes received
+	unsigned long	accepts;	// Connections accepted
+	ESP8266::AsyncOp ops[StartOps];	// Start commands
+	char		server[32];	// AT+CIPSERVER=1,port
+	int		starting;	// Start commands pending
+	bool		failed;		// A start command failed
+	unsigned long	t0;		// millis() when -c connect was started
+};
+
+static s_gwmod gwmods[ESPManager::MaxModules];
+static int starting = 0;		// Modules still starting
+
+//////////////////////////////////////////////////////////////////////
+// Receive callback (arg is the s_gwmod)
+//////////////////////////////////////////////////////////////////////
+
+static void
+server_recv(int sock,int byte,void *arg) {
+	s_gwmod& gw = *(s_gwmod *)arg;
+
+	if ( byte == -1 ) {
+		if ( opt_verbose )
+			printf("Module %d: sock %d closed\n",gw.mx,sock);
+	} else	++gw.bytes;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Accept callback (arg is the s_gwmod)
+//////////////////////////////////////////////////////////////////////
+
+static void
+accept_cb(int sock,void *arg) {
+	s_gwmod& gw = *(s_gwmod *)arg;
+
+	if ( sock >= 0 ) {
+		++gw.accepts;
+		gw.esp->accept(sock,server_recv,&gw);
+		if ( opt_verbose )
+			printf("Module %d: accepted sock %d\n",gw.mx,sock);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// The -c connect completed (user is the s_gwmod)
+//////////////////////////////////////////////////////////////////////
+
+static void
+connect_cb(int sock,ESP8266::Error err,void *user) {
+	s_gwmod& gw = *(s_gwmod *)user;
+	unsigned long ms = ESPSerial::millis(0) - gw.t0;
+
+	if ( err != ESP8266::Ok ) {
+		fprintf(stderr,"Module %d: connect to %s:%d failed: %s (%lu retries, %lu ms)\n",
+			gw.mx,opt_host,opt_port,gw.esp->strerror(err),gw.esp->get_retries(),ms);
+		gw.esp->close(sock);
+	} else if ( opt_verbose )
+		printf("Module %d: connected to %s:%d on sock %d (%lu retries, %lu ms)\n",
+			gw.mx,opt_host,opt_port,sock,gw.esp->get_retries(),ms);
+}
+
+//////////////////////////////////////////////////////////////////////
+// A start command completed (user is the s_gwmod)
+//////////////////////////////////////////////////////////////////////
+
+static void
+start_done(ESP8266::AsyncOp& op,void *user) {
+	s_gwmod& gw = *(s_gwmod *)user;
+
+	if ( op.result < 0 && op.str != unlisten ) {
+		fprintf(stderr,"Module %d: %s failed\n",gw.mx,op.str);
+		gw.failed = true;
+	}
+	if ( --gw.starting == 0 ) {
+		--starting;
+		if ( opt_verbose && !gw.failed )
+			printf("Module %d: started\n",gw.mx);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Queue the start commands of module mx
+//////////////////////////////////////////////////////////////////////
+
+static void
+start(ESPManager& mgr,int mx) {
+	static const char *cmds[] = { "ATE0", unlisten, "AT+CIPMODE=0", "AT+CIPMUX=1" };
+	s_gwmod& gw = gwmods[mx];
+	int n = 0;
+
+	gw.starting = 0;
+	gw.failed = false;
+	for ( ; n < 4; ++n )
+		gw.ops[n].str = cmds[n];
+	if ( opt_listen >= 0 ) {
+		snprintf(gw.server,sizeof gw.server,"AT+CIPSERVER=1,%d",opt_listen);
+		gw.ops[n++].str = gw.server;
+		gw.esp->set_accept(accept_cb,&gw);
+	}
+
+	++starting;
+	for ( int x=0; x<n; ++x ) {
+		ESP8266::AsyncOp& op = gw.ops[x];
+		const char *cmd = op.str;
+
+		memset(&op,0,sizeof op);
+		op.kind = ESP8266::OpCommand;
+		op.str = cmd;
+		op.done = start_done;
+		op.user = &gw;
+		++gw.starting;
+		mgr.submit(mx,op);
+	}
+}
+
+static void
+sigint(int sig) {
+	stop = true;
+}
+
+static void
+report(ESPManager& mgr) {
+	ESPManager::Stats st;
+
+	for ( int x=0; x<mgr.count(); ++x ) {
+		mgr.get_stats(x,st);
+		printf("  %-24s rx %8lu tx %8lu reads %7lu wakeups %7lu payload %8lu accepts %lu%s\n",
+			mgr.get_device(x),
+			st.rx_bytes,st.tx_bytes,st.rx_reads,st.wakeups,
+			gwmods[x].bytes,gwmods[x].accepts,
+			mgr.is_down(x) ? " (down)" : "");
+	}
+
+	mgr.get_totals(st);
+	printf("  %-24s rx %8lu tx %8lu reads %7lu wakeups %7lu loops %lu\n",
+		"TOTAL",
+		st.rx_bytes,st.tx_bytes,st.rx_reads,st.wakeups,
+		mgr.get_loops());
+	fflush(stdout);
+}
+
+static void
+usage(const char *cmd) {
+	const char *cp = strrchr(cmd,'/');
+
+	if ( cp )
+		cmd = cp + 1;
+
+	fprintf(stderr,
+		"Usage: %s -d device [-d device...] [-options..] [-B] [-v] [-h]\n"
+		"where options include:\n"
+		"\t-d device\tSerial device pathname (repeat for each module)\n"
+		"\t-b baudrate\tSerial baud rate (115200)\n"
+		"\t-L port\t\tListen on port (each module)\n"
+		"\t-i secs\t\tStatistics report interval (10)\n"
+		"\t-c host:port\tConnect each module to host:port once started\n"
+		"\t-r attempts\tAttempts of a busy connect (set_retry)\n"
+		"\t-B\t\tFind each module's baud rate, then raise it\n"
+		"\t-v\t\tVerbose output mode\n"
+		"\t-h\t\tThis help info.\n",
+		cmd);
+	exit(0);
+}
+
+int
+main(int argc,char **argv) {
+	static const char options[] = ":d:b:L:i:c:r:Bvh";
+	const char *devices[ESPManager::MaxModules];
+	int ndevices = 0, optch, er = 0;
+
+	while ( (optch = getopt(argc,argv,options)) != -1 ) {
+		switch ( optch ) {
+		case 'd':
+			if ( ndevices >= ESPManager::MaxModules ) {
+				fprintf(stderr,"Too many devices (max %d)\n",ESPManager::MaxModules);
+				++er;
+			} else	devices[ndevices++] = optarg;
+			break;
+		case 'b':
+			opt_baudrate = atoi(optarg);
+			break;
+		case 'L':
+			opt_listen = atoi(optarg);
+			break;
+		case 'i':
+			opt_interval = atoi(optarg);
+			break;
+		case 'c':
+			{
+				const char *cp = strrchr(optarg,':');
+
+				if ( !cp || cp == optarg || size_t(cp - optarg) >= sizeof opt_host ) {
+					fprintf(stderr,"Invalid -c %s (host:port)\n",optarg);
+					++er;
+				} else	{
+					snprintf(opt_host,sizeof opt_host,"%.*s",int(cp-optarg),optarg);
+					opt_port = atoi(cp+1);
+				}
+			}
+			break;
+		case 'r':
+			opt_retry = atoi(optarg);
+			break;
+		case 'B':
+			opt_probe = true;
+			break;
+		case 'v':
+			opt_verbose = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			break;
+		case ':':
+			fprintf(stderr,"Missing argument for -%c\n",optopt);
+			++er;
+			break;
+		default:
+			fprintf(stderr,"Invalid option -%c\n",optopt);
+			++er;
+		}
+	}
+
+	if ( er > 0 || ndevices < 1 ) {
+		fprintf(stderr,"Use option -h for more information.\n");
+		exit(1);
+	}
+
+	ESPManager mgr;
+
+	for ( int x=0; x<ndevices; ++x ) {
+		int mx = mgr.add(devices[x],opt_baudrate);
+
+		if ( mx < 0 ) {
+			fprintf(stderr,"Unable to open %s\n",devices[x]);
+			exit(3);
+		}
+
+		if ( opt_probe ) {		// Bounded: about 40 ms per rate tried
+			ESPSerial& serial = *mgr.get_serial(mx);
+
+			if ( !serial.probe_baud(true) ) {
+				fprintf(stderr,"No response from %s at any baud rate\n",devices[x]);
+				exit(3);
+			}
+			if ( opt_verbose )
+				printf("%s at %d baud\n",devices[x],serial.get_baudrate());
+		}
+
+		ESP8266& esp = *mgr.get(mx);
+		s_gwmod& gw = gwmods[mx];
+
+		gw.esp = &esp;
+		gw.mx = mx;
+		gw.bytes = gw.accepts = 0;
+		if ( opt_retry > 0 )
+			esp.set_retry(opt_retry);
+		start(mgr,mx);
+	}
+
+	signal(SIGINT,sigint);
+
+	time_t t0 = time(0);
+
+	while ( !stop && starting > 0 && time(0) - t0 < StartSecs )
+		mgr.run_once(100);
+
+	for ( int mx=0; mx<mgr.count(); ++mx ) {
+		if ( gwmods[mx].starting > 0 || gwmods[mx].failed || mgr.is_down(mx) ) {
+			fprintf(stderr,"Unable to start ESP8266 on %s\n",mgr.get_device(mx));
+			exit(13);
+		}
+	}
+
+	for ( int mx=0; opt_port >= 0 && mx<mgr.count(); ++mx ) {
+		s_gwmod& gw = gwmods[mx];
+
+		gw.t0 = ESPSerial::millis(0);
+		if ( gw.esp->tcp_connect_async(opt_host,opt_port,server_recv,&gw,connect_cb) < 0 )
+			fprintf(stderr,"Module %d: no socket for %s:%d\n",mx,opt_host,opt_port);
+	}
+	t0 = time(0);
+
+	while ( !stop ) {
+		mgr.run_once(1000);
+
+		if ( opt_interval > 0 && time(0) - t0 >= opt_interval ) {
+			report(mgr);
+			t0 = time(0);
+		}
+	}
+
+	report(mgr);
+	return 0;
+}
+
+// End espgw.cpp
@@ -0,0 +1,408 @@
+///////////////////////////////////////////////////////////////////////
+// espmgr.cpp -- Drive many ESP8266 modules from one epoll(7) loop
+// Date: Sun Oct 18 14:40:52 2026
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "espmgr.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// A module: the ESP8266 reads from the module's frame buffer, and
+// writes to its serial device
+//////////////////////////////////////////////////////////////////////
+
+ESPManager::s_module::s_module()
+	: esp(writeb,readb,rpoll,idle,this),
+	  device(0), wakeups(0), receives(0), down(false), servicing(false),
+	  fx(0), flen(0), fdone(0), fstate(FrLine), col(0), need(0), hlen(0) {
+	esp.get_io().set_writebuf(writebuf);
+	esp.get_io().set_clock(ESPSerial::millis);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Add a received byte to frame[], and advance fdone past each frame
+// that it completes: a line (LF), the '>' send prompt, or an +IPD
+// header and its payload
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPManager::s_module::frame_byte(char b) {
+
+	frame[flen++] = b;
+
+	switch ( fstate ) {
+	case FrLine:
+		if ( b == '\n' ) {
+			col = 0;
+			fdone = flen;
+		} else if ( col++ == 0 && b == '>' ) {
+			fdone = flen;		// Prompt: no LF follows
+		} else if ( col == 5 && !memcmp(frame+flen-5,"+IPD,",5) ) {
+			fstate = FrHeader;
+			hlen = 0;
+		}
+		break;
+	case FrHeader:			// id,len: or len: (then ,ip,port with CIPDINFO)
+		if ( b == ':' ) {
+			const char *cp;
+
+			hdr[hlen] = 0;
+			cp = strchr(hdr,',');
+			need = atoi(cp ? cp + 1 : hdr);
+			fstate = need > 0 ? FrPayload : FrLine;
+			col = 0;
+			if ( need <= 0 )
+				fdone = flen;
+		} else if ( b == '\n' ) {
+			fstate = FrLine;	// Not an +IPD header after all
+			col = 0;
+			fdone = flen;
+		} else if ( hlen + 1 < int(sizeof hdr) ) {
+			hdr[hlen++] = b;
+		} else	fstate = FrLine;
+		break;
+	case FrPayload:
+		if ( --need <= 0 ) {
+			fstate = FrLine;
+			col = 0;
+			fdone = flen;
+		}
+		break;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Move the device's available input to frame[] (non-blocking).
+// Returns true if unread bytes are held.
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPManager::s_module::pull() {
+
+	if ( fx >= flen )
+		fx = flen = fdone = 0;
+
+	if ( !down && serial.fill() < 0 )
+		down = true;
+
+	while ( serial.pending() ) {
+		if ( flen >= FrameSize ) {
+			if ( fx > 0 ) {
+				memmove(frame,frame+fx,flen-fx);
+				flen -= fx;
+				fdone -= fx;
+				fx = 0;
+			} else	{
+				fdone = flen;	// Too long for a frame: framing lost,
+				fstate = FrLine; // resume at the next line
+				col = 1;
+				break;
+			}
+		}
+		frame_byte(ESPSerial::readb(&serial));
+	}
+	return fx < flen;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ESP8266 I/O callbacks: rpoll() is true only for complete frames,
+// so receive() never waits for the rest of one. readb() only waits
+// (up to the device's idle wait at a time) for blocking commands,
+// and returns LF when the device is down.
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPManager::s_module::writeb(char b,void *user) {
+	((s_module *)user)->serial.put(b);
+}
+
+void
+ESPManager::s_module::writebuf(const char *data,int bytes,void *user) {
+	((s_module *)user)->serial.put(data,bytes);
+}
+
+char
+ESPManager::s_module::readb(void *user) {
+	s_module& mod = *(s_module *)user;
+
+	while ( mod.fx >= mod.flen && !mod.pull() ) {
+		if ( mod.down )
+			return '\n';
+		ESPSerial::idle(&mod.serial);
+	}
+	return mod.frame[mod.fx++];
+}
+
+bool
+ESPManager::s_module::rpoll(void *user) {
+	s_module& mod = *(s_module *)user;
+
+	if ( mod.fx >= mod.fdone )
+		mod.pull();
+	return mod.fx < mod.fdone;
+}
+
+void
+ESPManager::s_module::idle(void *user) {
+	s_module& mod = *(s_module *)user;
+
+	if ( mod.servicing )
+		return;
+	if ( mod.down )
+		usleep(10000);		// Don't spin on a dead device
+	else if ( mod.fx >= mod.fdone )
+		ESPSerial::idle(&mod.serial);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Constructor
+//////////////////////////////////////////////////////////////////////
+
+ESPManager::ESPManager() : nmodules(0), loops(0) {
+	efd = epoll_create1(EPOLL_CLOEXEC);
+}
+
+ESPManager::~ESPManager() {
+
+	for ( int x=0; x<nmodules; ++x )
+		delete modules[x];
+	if ( efd >= 0 )
+		::close(efd);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Open a device and add it to the epoll set
+//////////////////////////////////////////////////////////////////////
+
+int
+ESPManager::add(const char *device,int baudrate) {
+	struct epoll_event ev;
+
+	if ( efd < 0 || nmodules >= MaxModules )
+		return -1;
+
+	s_module *mod = new s_module;
+
+	if ( !mod->serial.open(device,baudrate) ) {
+		delete mod;
+		return -1;
+	}
+
+	memset(&ev,0,sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.u32 = nmodules;
+
+	if ( epoll_ctl(efd,EPOLL_CTL_ADD,mod->serial.get_fd(),&ev) == -1 ) {
+		delete mod;
+		return -1;
+	}
+
+	mod->device = device;
+	modules[nmodules] = mod;
+	return nmodules++;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Accessors
+//////////////////////////////////////////////////////////////////////
+
+ESP8266 *
+ESPManager::get(int mx) {
+
+	if ( mx < 0 || mx >= nmodules )
+		return 0;
+	return &modules[mx]->esp;
+}
+
+ESPSerial *
+ESPManager::get_serial(int mx) {
+
+	if ( mx < 0 || mx >= nmodules )
+		return 0;
+	return &modules[mx]->serial;
+}
+
+const char *
+ESPManager::get_device(int mx) const {
+
+	if ( mx < 0 || mx >= nmodules )
+		return 0;
+	return modules[mx]->device;
+}
+
+bool
+ESPManager::is_down(int mx) const {
+
+	if ( mx < 0 || mx >= nmodules )
+		return true;
+	return modules[mx]->down;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Queue an asynchronous operation for module mx, and issue it if it
+// is first. run_once() advances it as the responses arrive.
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPManager::submit(int mx,ESP8266::AsyncOp& op) {
+
+	if ( mx < 0 || mx >= nmodules || modules[mx]->down )
+		return false;
+
+	ESP8266& esp = modules[mx]->esp;
+
+	esp.submit(op);
+	esp.advance();
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Run the receiver for one readable module, over the complete frames
+// received, then advance its operations. The idle callback must not
+// block here, since other modules may also be readable.
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPManager::service(s_module& mod) {
+
+	++mod.wakeups;
+	mod.servicing = true;
+
+	if ( mod.pull() && mod.fx < mod.fdone ) {
+		mod.esp.receive();
+		++mod.receives;
+	}
+
+	mod.servicing = false;
+	tick(mod);
+	if ( mod.down )
+		remove(mod);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Advance a module's operations, which includes the timed steps (send
+// pacing, connect backoff) that no input triggers. With none pending,
+// send any coalesced bytes whose delay has passed (this blocks, like
+// any command, until the module answers).
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPManager::tick(s_module& mod) {
+	bool pending;
+
+	mod.servicing = true;
+	pending = mod.esp.advance();
+	mod.servicing = false;
+
+	if ( !pending && !mod.down )
+		mod.esp.flush_due();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Stop polling a device that hung up (epoll would report it forever)
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPManager::remove(s_module& mod) {
+
+	mod.down = true;
+	epoll_ctl(efd,EPOLL_CTL_DEL,mod.serial.get_fd(),0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Wait up to timeout_ms for readable modules and service them. The
+// wait ends early when a module's timed step falls due (see
+// ESP8266::next_due()), and the modules not readable are then ticked.
+//////////////////////////////////////////////////////////////////////
+
+int
+ESPManager::run_once(int timeout_ms) {
+	struct epoll_event evs[MaxModules];
+	bool serviced[MaxModules];
+	long due;
+	int rc;
+
+	++loops;
+
+	for ( int mx=0; mx<nmodules; ++mx ) {
+		serviced[mx] = false;
+		if ( !modules[mx]->down && (due = modules[mx]->esp.next_due()) >= 0 )
+			if ( timeout_ms < 0 || due < timeout_ms )
+				timeout_ms = int(due);
+	}
+
+	do	{
+		rc = epoll_wait(efd,evs,MaxModules,timeout_ms);
+	} while ( rc == -1 && errno == EINTR );
+
+	for ( int x=0; x<rc; ++x ) {
+		unsigned mx = evs[x].data.u32;
+
+		if ( mx >= unsigned(nmodules) )
+			continue;
+		service(*modules[mx]);
+		serviced[mx] = true;
+		if ( evs[x].events & (EPOLLHUP|EPOLLERR) )
+			remove(*modules[mx]);
+	}
+
+	for ( int mx=0; mx<nmodules; ++mx )
+		if ( !serviced[mx] && !modules[mx]->down )
+			tick(*modules[mx]);
+
+	return rc < 0 ? 0 : rc;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Run until stop becomes true
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPManager::run(volatile bool& stop,int timeout_ms) {
+
+	while ( !stop )
+		run_once(timeout_ms);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Statistics
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPManager::get_stats(int mx,Stats& stats) const {
+
+	if ( mx < 0 || mx >= nmodules )
+		return false;
+
+	const s_module& mod = *modules[mx];
+
+	stats.rx_bytes = mod.serial.get_rx_bytes();
+	stats.tx_bytes = mod.serial.get_tx_bytes();
+	stats.rx_reads = mod.serial.get_rx_reads();
+	stats.wakeups = mod.wakeups;
+	stats.receives = mod.receives;
+	return true;
+}
+
+void
+ESPManager::get_totals(Stats& stats) const {
+	Stats s;
+
+	memset(&stats,0,sizeof stats);
+	for ( int x=0; x<nmodules; ++x ) {
+		get_stats(x,s);
+		stats.rx_bytes += s.rx_bytes;
+		stats.tx_bytes += s.tx_bytes;
+		stats.rx_reads += s.rx_reads;
+		stats.wakeups += s.wakeups;
+		stats.receives += s.receives;
+	}
+}
+
+// End espmgr.cpp
@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////////////
+// espmgr.hpp -- Drive many ESP8266 modules from one epoll(7) loop
+// Date: Sun Oct 18 14:40:52 2026
+///////////////////////////////////////////////////////////////////////
+//
+// ESPManager owns up to MaxModules ESP8266 instances, each with its own
+// ESPSerial device. run_once() waits in a single epoll_wait(2) and
+// calls ESP8266::receive() only for the devices that are readable, so
+// CPU use follows the traffic rather than the number of modules.
+//
+// receive() reads a whole line or +IPD payload once it has begun, so
+// each module's input is held in a frame buffer, and receive() is only
+// run once a complete frame (line, +IPD header and payload, or the '>'
+// prompt) has arrived. A module sending a partial frame thus never
+// stalls the others. A device that hangs up is removed from the epoll
+// set and reported by is_down().
+//
+// Commands block until answered: to start many modules at once, use
+// submit(), which queues asynchronous operations (see ESP8266::submit())
+// that run_once() advances as the responses arrive.
+//
+// Some steps are timed rather than answered: a paced send slot, the
+// backoff before a busy connect is retried, and coalesced writes held
+// for their delay. run_once() ends its wait at the nearest of these
+// (ESP8266::next_due()), and advances every module's operations each
+// call, so they proceed on a quiet module too.
+//
+// This module is Linux specific (epoll).
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef ESPMGR_HPP
+#define ESPMGR_HPP
+
+#include "esp8266.hpp"
+#include "espserial.hpp"
+
+class ESPManager {
+public:
+	enum {
+		MaxModules = 16,
+		FrameSize = 4096		// Frame buffer (> the largest +IPD frame)
+	};
+
+	struct Stats {
+		unsigned long	rx_bytes;	// Bytes read from device(s)
+		unsigned long	tx_bytes;	// Bytes written to device(s)
+		unsigned long	rx_reads;	// read(2) calls returning data
+		unsigned long	wakeups;	// Times found readable by epoll
+		unsigned long	receives;	// ESP8266::receive() calls
+	};
+
+private:
+	enum FrameState {		// Framing of the received stream
+		FrLine,				// In a line (col bytes in)
+		FrHeader,			// In "+IPD,..:" after the comma
+		FrPayload			// In +IPD payload (need bytes left)
+	};
+
+	struct s_module {
+		ESPSerial	serial;		// Must precede esp
+		ESP8266		esp;
+		const char	*device;	// Device pathname
+		unsigned long	wakeups;	// Times found readable
+		unsigned long	receives;	// receive() calls
+		bool		down;		// Device hung up or failed
+		bool		servicing;	// In service(): idle() must not wait
+
+		char		frame[FrameSize]; // Received bytes
+		int		fx;		// Next byte for readb()
+		int		flen;		// Bytes in frame[]
+		int		fdone;		// End of the last complete frame
+		FrameState	fstate;
+		int		col;		// Bytes into the line (FrLine)
+		int		need;		// Payload bytes left (FrPayload)
+		char		hdr[24];	// +IPD header fields (FrHeader)
+		int		hlen;
+
+		s_module();
+		void frame_byte(char b);	// Add a received byte
+		bool pull();			// Move device input to frame[]
+
+		// ESP8266 I/O callbacks (user is the s_module *)
+		static void writeb(char b,void *user);
+		static void writebuf(const char *data,int bytes,void *user);
+		static char readb(void *user);
+		static bool rpoll(void *user);
+		static void idle(void *user);
+	};
+
+	int		efd;			// epoll fd
+	int		nmodules;		// Modules in use
+	s_module	*modules[MaxModules];	// Owned modules
+	unsigned long	loops;			// run_once() calls
+
+	void service(s_module& mod);
+	void tick(s_module& mod);		// Advance operations, flush due writes
+	void remove(s_module& mod);		// Take a failed device out of the epoll set
+
+public:	ESPManager();
+	~ESPManager();
+
+	int add(const char *device,int baudrate); // Returns module index, else -1
+	inline int count() const		{ return nmodules; }
+
+	ESP8266 *get(int mx);			// Module's ESP8266, else nullptr
+	ESPSerial *get_serial(int mx);		// Module's serial device, else nullptr
+	const char *get_device(int mx) const;
+	bool is_down(int mx) const;		// Device hung up (or bad index)
+
+	bool submit(int mx,ESP8266::AsyncOp& op); // Queue an operation for module mx
+
+	int run_once(int timeout_ms);		// One epoll wait, returns modules serviced
+	void run(volatile bool& stop,int timeout_ms=1000);
+
+	bool get_stats(int mx,Stats& stats) const;	// Per module stats
+	void get_totals(Stats& stats) const;	// Aggregate stats
+	inline unsigned long get_loops() const	{ return loops; }
+};
+
+#endif // ESPMGR_HPP
+
+// End espmgr.hpp
@@ -0,0 +1,459 @@
+///////////////////////////////////////////////////////////////////////
+// espnetser.cpp -- Serial-over-TCP transport for ESP8266 (raw/RFC 2217)
+// Date: Sun Oct 18 21:58:40 2026
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "espnetser.hpp"
+
+enum {				// Telnet (RFC 854) and COM-PORT-OPTION (RFC 2217)
+	IAC = 255, DONT = 254, DO = 253, WONT = 252, WILL = 251,
+	SB = 250, SE = 240,
+	OptBinary = 0, OptSGA = 3, OptComPort = 44,
+	CpSetBaudrate = 1, CpSetDatasize = 2, CpSetParity = 3,
+	CpSetStopsize = 4, CpSetControl = 5,
+	CpServer = 100			// Added to the command in server replies
+};
+
+//////////////////////////////////////////////////////////////////////
+// Constructor
+//////////////////////////////////////////////////////////////////////
+
+ESPNetSerial::ESPNetSerial()
+	: fd(-1), telnet(false), baudrate(0), bufx(0), buflen(0), txlen(0), idle_ms(10),
+	  tnstate(TnData), tncmd(0), sblen(0),
+	  rtt_t0(0), rtt_min(0), rtt_avg(0), rtt_samples(0),
+	  rx_bytes(0), tx_bytes(0), tx_segments(0) {
+}
+
+ESPNetSerial::~ESPNetSerial() {
+	close();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Connect to the serial server (RFC 2217 if baudrate > 0)
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPNetSerial::open(const char *host,int port,int baudrate) {
+	struct addrinfo hints, *res, *ai;
+	char service[16];
+	int on = 1;
+
+	close();
+
+	memset(&hints,0,sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service,sizeof service,"%d",port);
+
+	if ( getaddrinfo(host,service,&hints,&res) != 0 ) {
+		errno = EHOSTUNREACH;
+		return false;
+	}
+
+	for ( ai = res; ai; ai = ai->ai_next ) {
+		if ( (fd = socket(ai->ai_family,ai->ai_socktype|SOCK_CLOEXEC,ai->ai_protocol)) == -1 )
+			continue;
+		if ( connect(fd,ai->ai_addr,ai->ai_addrlen) == 0 )
+			break;
+		::close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if ( fd == -1 )
+		return false;
+
+	setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof on);
+	fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) | O_NONBLOCK);
+
+	bufx = buflen = txlen = 0;
+	tnstate = TnData;
+	telnet = baudrate > 0;
+	this->baudrate = baudrate;
+
+	if ( telnet ) {
+		static const unsigned char nego[] = {
+			IAC, WILL, OptComPort,
+			IAC, WILL, OptBinary, IAC, DO, OptBinary,
+			IAC, WILL, OptSGA, IAC, DO, OptSGA
+		};
+
+		send_raw(nego,sizeof nego);
+		comport(CpSetDatasize,8,1);
+		comport(CpSetParity,1,1);		// None
+		comport(CpSetStopsize,1,1);		// 1 bit
+		comport(CpSetControl,3,1);		// Hardware flow control
+		comport(CpSetBaudrate,baudrate,4);	// Reply is timed
+		if ( !flush() ) {
+			close();
+			return false;
+		}
+		rtt_t0 = micros();
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Close the connection
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPNetSerial::close() {
+
+	if ( fd >= 0 ) {
+		flush();
+		::close(fd);
+		fd = -1;
+	}
+	bufx = buflen = txlen = 0;
+	rtt_t0 = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Wait up to ms milliseconds for events (-1 waits forever)
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPNetSerial::wait(short events,int ms) {
+	struct pollfd p = { fd, events, 0 };
+	int rc;
+
+	do	{
+		rc = poll(&p,1,ms);
+	} while ( rc == -1 && errno == EINTR );
+
+	return rc == 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Monotonic clock in microseconds
+//////////////////////////////////////////////////////////////////////
+
+unsigned long
+ESPNetSerial::micros() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+}
+
+//////////////////////////////////////////////////////////////////////
+// A response arrived: complete the round trip being timed
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPNetSerial::sample() {
+	unsigned long us;
+
+	if ( !rtt_t0 )
+		return;
+
+	us = micros() - rtt_t0;
+	rtt_t0 = 0;
+
+	if ( !rtt_samples++ )
+		rtt_min = rtt_avg = us;
+	else	{
+		if ( us < rtt_min )
+			rtt_min = us;
+		rtt_avg = rtt_avg - rtt_avg / 8 + us / 8;	// 1/8 smoothing (as TCP SRTT)
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Append bytes to the segment as is (Telnet commands)
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPNetSerial::send_raw(const unsigned char *data,int bytes) {
+
+	while ( bytes-- > 0 ) {
+		if ( txlen >= int(sizeof txbuf) )
+			flush();
+		txbuf[txlen++] = *data++;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Send COM-PORT-OPTION cmd with a value of 1 or 4 bytes
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPNetSerial::comport(unsigned char cmd,unsigned long value,int bytes) {
+	unsigned char b[3] = { IAC, SB, OptComPort };
+
+	send_raw(b,3);
+	send_raw(&cmd,1);
+	while ( bytes-- > 0 ) {
+		unsigned char v = value >> (bytes * 8);
+
+		send_raw(&v,1);
+		if ( v == IAC )
+			send_raw(&v,1);		// Escaped
+	}
+	b[1] = SE;
+	send_raw(b,2);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Answer IAC WILL/WONT/DO/DONT: refuse what we do not support, and
+// stay silent for what we do (it is already in effect)
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPNetSerial::option(unsigned char cmd,unsigned char opt) {
+	unsigned char reply[3] = { IAC, 0, opt };
+	bool ours = opt == OptBinary || opt == OptSGA || (opt == OptComPort && cmd == DO);
+
+	if ( ours || cmd == WONT || cmd == DONT )
+		return;
+	reply[1] = cmd == DO ? WONT : DONT;
+	send_raw(reply,3);
+	flush();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Received COM-PORT-OPTION replies: time the SET-BAUDRATE reply
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPNetSerial::subneg() {
+
+	if ( sblen >= 2 && sb[0] == OptComPort && sb[1] == CpServer + CpSetBaudrate )
+		sample();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read whatever is available without blocking. Returns the number of
+// bytes now buffered, or -1 if the connection failed.
+//////////////////////////////////////////////////////////////////////
+
+int
+ESPNetSerial::fill() {
+	int rc, x, out;
+
+	if ( bufx >= buflen )
+		bufx = buflen = 0;
+
+	if ( buflen >= int(sizeof buf) )
+		return buflen - bufx;		// Buffer is full
+
+	do	{
+		rc = ::recv(fd,buf+buflen,sizeof buf-buflen,0);
+	} while ( rc == -1 && errno == EINTR );
+
+	if ( rc == 0 || (rc == -1 && errno != EAGAIN && errno != EWOULDBLOCK) )
+		return -1;
+	if ( rc < 0 )
+		return buflen - bufx;
+
+	rx_bytes += rc;
+	if ( !telnet ) {
+		buflen += rc;
+		sample();
+		return buflen - bufx;
+	}
+
+	// Decode Telnet in place (output never overtakes input)
+
+	for ( x = out = buflen; x < buflen + rc; ++x ) {
+		unsigned char b = buf[x];
+
+		switch ( tnstate ) {
+		case TnData:
+			if ( b == IAC )
+				tnstate = TnIac;
+			else	buf[out++] = b;
+			break;
+		case TnIac:
+			if ( b == IAC ) {
+				buf[out++] = b;		// Escaped 0xFF
+				tnstate = TnData;
+			} else if ( b >= WILL ) {
+				tncmd = b;
+				tnstate = TnOption;
+			} else if ( b == SB ) {
+				sblen = 0;
+				tnstate = TnSb;
+			} else	tnstate = TnData;	// NOP, GA etc.
+			break;
+		case TnOption:
+			option(tncmd,b);
+			tnstate = TnData;
+			break;
+		case TnSb:
+			if ( b == IAC )
+				tnstate = TnSbIac;
+			else if ( sblen < SbSize )
+				sb[sblen++] = b;
+			break;
+		case TnSbIac:
+			if ( b == SE ) {
+				subneg();
+				tnstate = TnData;
+			} else	{
+				if ( sblen < SbSize )
+					sb[sblen++] = b;
+				tnstate = TnSb;
+			}
+			break;
+		}
+	}
+
+	if ( out > buflen )
+		sample();
+	buflen = out;
+	return buflen - bufx;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Add one byte to the segment, sending it at the end of a line
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPNetSerial::put(char b) {
+
+	if ( txlen >= int(sizeof txbuf) - 1 )
+		flush();			// Room for an escaped byte
+
+	txbuf[txlen++] = b;
+	if ( telnet && (unsigned char)b == IAC )
+		txbuf[txlen++] = b;
+
+	if ( b == '\n' ) {
+		flush();
+		if ( !rtt_t0 ) {
+			fill();			// Take in what preceded the command
+			rtt_t0 = micros();	// and time the response
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Add bytes to the segment. A block too large for the buffer is sent
+// after it directly (raw mode), saving the copy.
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPNetSerial::put(const char *data,int bytes) {
+	int rc;
+
+	if ( telnet || txlen + bytes <= int(sizeof txbuf) ) {
+		while ( bytes-- > 0 )
+			put(*data++);
+		return;
+	}
+
+	flush();
+	while ( bytes > 0 ) {
+		rc = ::send(fd,data,bytes,MSG_NOSIGNAL);
+		if ( rc > 0 ) {
+			data += rc;
+			bytes -= rc;
+			tx_bytes += rc;
+			++tx_segments;
+		} else if ( rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+			wait(POLLOUT,-1);
+		else if ( rc == -1 && errno != EINTR )
+			return;			// Connection failed: fill() reports it
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write the pending segment
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPNetSerial::flush() {
+	int rc, x = 0;
+
+	while ( x < txlen ) {
+		rc = ::send(fd,txbuf+x,txlen-x,MSG_NOSIGNAL);
+		if ( rc > 0 ) {
+			x += rc;
+			tx_bytes += rc;
+			++tx_segments;
+		} else if ( rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+			wait(POLLOUT,-1);
+		else if ( rc == -1 && errno == EINTR )
+			;
+		else	{
+			txlen = 0;		// Connection failed: fill() reports it
+			return false;
+		}
+	}
+	txlen = 0;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ESP8266 I/O callbacks
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPNetSerial::writeb(char b,void *user) {
+	((ESPNetSerial *)user)->put(b);
+}
+
+void
+ESPNetSerial::writebuf(const char *data,int bytes,void *user) {
+	((ESPNetSerial *)user)->put(data,bytes);
+}
+
+char
+ESPNetSerial::readb(void *user) {
+	ESPNetSerial& net = *(ESPNetSerial *)user;
+
+	if ( net.txlen > 0 )
+		net.flush();
+
+	while ( !net.pending() ) {
+		int rc = net.fill();
+
+		if ( rc > 0 )
+			break;
+		if ( rc < 0 )
+			return '\n';		// Connection lost
+		net.wait(POLLIN,-1);
+	}
+	return net.buf[net.bufx++];
+}
+
+bool
+ESPNetSerial::rpoll(void *user) {
+	ESPNetSerial& net = *(ESPNetSerial *)user;
+
+	if ( net.txlen > 0 )
+		net.flush();
+	return net.pending() || net.fill() > 0;
+}
+
+void
+ESPNetSerial::idle(void *user) {
+	ESPNetSerial& net = *(ESPNetSerial *)user;
+
+	if ( net.txlen > 0 )
+		net.flush();
+	if ( net.idle_ms > 0 && !net.pending() )
+		net.wait(POLLIN,net.idle_ms);
+}
+
+unsigned long
+ESPNetSerial::millis(void *user) {
+	return micros() / 1000;
+}
+
+// End espnetser.cpp
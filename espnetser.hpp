@@ -0,0 +1,116 @@
+///////////////////////////////////////////////////////////////////////
+// espnetser.hpp -- Serial-over-TCP transport for ESP8266 (raw/RFC 2217)
+// Date: Sun Oct 18 21:58:40 2026
+///////////////////////////////////////////////////////////////////////
+//
+// ESPNetSerial reaches a module on a remote serial server (ser2net,
+// a terminal server, or sertcp.cpp) and provides the same ESP8266 I/O
+// callbacks as ESPSerial:
+//
+//	ESPNetSerial net;
+//	net.open("serverhost",2217,115200);	// RFC 2217 (baudrate 0: raw)
+//	ESP8266 esp(ESPNetSerial::writeb,ESPNetSerial::readb,
+//		ESPNetSerial::rpoll,ESPNetSerial::idle,&net);
+//
+// Written bytes are gathered into one TCP segment, which is sent at
+// the end of each command line, when the buffer fills, or as soon as
+// the ESP8266 class waits for input. Nagle is disabled (TCP_NODELAY),
+// so a command is never held back waiting for an ACK. Reads are
+// buffered as in ESPSerial.
+//
+// In RFC 2217 mode the stream is Telnet: 0xFF bytes are escaped, the
+// server's option negotiation is answered, and the baud rate, 8N1 and
+// hardware flow control are requested with COM-PORT-OPTION.
+//
+// Latency: the time from sending a command line to the first byte
+// that follows is sampled (and the server's reply to SET-BAUDRATE in
+// RFC 2217 mode). get_rtt_min() approximates the link latency alone;
+// get_rtt_avg() also includes the module's response time.
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef ESPNETSER_HPP
+#define ESPNETSER_HPP
+
+class ESPNetSerial {
+	enum {
+		BufSize = 512,			// Read buffer size
+		TxSize = 512,			// Write (segment) buffer size
+		SbSize = 16			// Telnet subnegotiation buffer size
+	};
+
+	enum TnState {			// Telnet receive state (RFC 2217 mode)
+		TnData,				// Data bytes
+		TnIac,				// After IAC
+		TnOption,			// After IAC WILL/WONT/DO/DONT
+		TnSb,				// In IAC SB .. IAC SE
+		TnSbIac				// After IAC within SB
+	};
+
+	int		fd;			// Connected socket, else -1
+	bool		telnet;			// RFC 2217 mode
+	int		baudrate;		// Requested baud rate (RFC 2217)
+	char		buf[BufSize];		// Read buffer (decoded)
+	int		bufx;			// Next byte in buf[]
+	int		buflen;			// Bytes in buf[]
+	char		txbuf[TxSize];		// Pending write segment
+	int		txlen;			// Bytes in txbuf[]
+	int		idle_ms;		// Max wait in idle()
+
+	TnState		tnstate;
+	unsigned char	tncmd;			// WILL/WONT/DO/DONT being received
+	unsigned char	sb[SbSize];		// Subnegotiation bytes
+	int		sblen;
+
+	unsigned long	rtt_t0;			// Microseconds when timing began, else 0
+	unsigned long	rtt_min;		// Least round trip (us), else 0
+	unsigned long	rtt_avg;		// Smoothed round trip (us)
+	unsigned long	rtt_samples;
+
+	unsigned long	rx_bytes;		// Bytes received (before decoding)
+	unsigned long	tx_bytes;		// Bytes sent (after escaping)
+	unsigned long	tx_segments;		// write(2) calls
+
+	bool wait(short events,int ms);		// poll(2) for events
+	void sample();				// Complete a round trip sample
+	void option(unsigned char cmd,unsigned char opt);	// Answer negotiation
+	void subneg();				// Received IAC SB .. IAC SE
+	void send_raw(const unsigned char *data,int bytes); // Append without escaping
+	void comport(unsigned char cmd,unsigned long value,int bytes);	// COM-PORT-OPTION request
+
+	static unsigned long micros();
+
+public:	ESPNetSerial();
+	~ESPNetSerial();
+
+	bool open(const char *host,int port,int baudrate=0);	// baudrate > 0 selects RFC 2217
+	void close();
+
+	inline int get_fd() const		{ return fd; }
+	inline bool pending() const		{ return bufx < buflen; }
+	inline void set_idle_wait(int ms)	{ idle_ms = ms; }
+
+	int fill();				// Read available data (non-blocking)
+	void put(char b);			// Write one byte (buffered)
+	void put(const char *data,int bytes);	// Write bytes (buffered, if small)
+	bool flush();				// Send the pending segment
+
+	inline unsigned long get_rx_bytes() const { return rx_bytes; }
+	inline unsigned long get_tx_bytes() const { return tx_bytes; }
+	inline unsigned long get_tx_segments() const { return tx_segments; }
+	inline unsigned long get_rtt_min() const { return rtt_min; }		// Microseconds
+	inline unsigned long get_rtt_avg() const { return rtt_avg; }		// Microseconds
+	inline unsigned long get_rtt_samples() const { return rtt_samples; }
+
+	// ESP8266 I/O callbacks (user is the ESPNetSerial *)
+	static void writeb(char b,void *user);
+	static void writebuf(const char *data,int bytes,void *user);	// For ESP8266FuncIo::set_writebuf()
+	static char readb(void *user);
+	static bool rpoll(void *user);
+	static void idle(void *user);
+	static unsigned long millis(void *user);	// For ESP8266FuncIo::set_clock()
+};
+
+#endif // ESPNETSER_HPP
+
+// End espnetser.hpp
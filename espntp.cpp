@@ -14,26 +14,22 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <assert.h>
+#include <stdint.h>
+#include <arpa/inet.h>
 
 #include "esp8266.hpp"
 
-static void writeb(char b);
-static char readb();
-static bool rpoll();
-static void idle();
-
-static ESP8266 esp(writeb,readb,rpoll,idle);
-static int fd = -1;
 static bool opt_verbose = false;
 static int opt_baudrate = 115200;
 static const char *opt_device = "/dev/cu.usbserial-A50285BI";
 
 //////////////////////////////////////////////////////////////////////
-// Write byte callback
+// Write byte callback (arg points to the serial fd)
 //////////////////////////////////////////////////////////////////////
 
 static void
-writeb(char b) {
+writeb(char b,void *arg) {
+	int fd = *(int *)arg;
 	int rc;
 
 	do	{
@@ -47,7 +43,8 @@ writeb(char b) {
 //////////////////////////////////////////////////////////////////////
 
 static char
-readb() {
+readb(void *arg) {
+	int fd = *(int *)arg;
 	char b;
 	int rc;
 
@@ -64,11 +61,11 @@ readb() {
 //////////////////////////////////////////////////////////////////////
 
 static bool
-rpoll() {
+rpoll(void *arg) {
 	struct pollfd p;
 	int rc;
 
-	p.fd = fd;
+	p.fd = *(int *)arg;
 	p.events = POLLIN;
 	p.revents = 0;
 
@@ -84,27 +81,41 @@ rpoll() {
 //////////////////////////////////////////////////////////////////////
 
 static void
-idle() {
+idle(void *arg) {
 	usleep(100);
 }
 
+//////////////////////////////////////////////////////////////////////
+// Millisecond clock (for the command retry backoff)
+//////////////////////////////////////////////////////////////////////
+
+static unsigned long
+millis(void *arg) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
 //////////////////////////////////////////////////////////////////////
 // UDP Receiving
 //////////////////////////////////////////////////////////////////////
 
-static uint32_t rxbuf[12];	// NTP receiving buffer
-static char *rxp = 0;		// rx_cb byte pointer within rxbuf
-static unsigned rx = 0;		// Index for rxp[rx]
-static bool rx_done = false;	// End of datagram seen
+struct s_ntprx {
+	uint32_t	rxbuf[12];	// NTP receiving buffer
+	unsigned	rx;		// Byte index into rxbuf
+	bool		rx_done;	// End of datagram seen
+};
 
 static void
-rx_cb(int s,int ch) {
+rx_cb(int s,int ch,void *arg) {
+	s_ntprx& ntp = *(s_ntprx *)arg;
 
 	if ( ch == -1 ) {
-		rx_done = true;
+		ntp.rx_done = true;
 	} else	{
-		if ( rx < sizeof rxbuf )
-			rxp[rx++] = ch;
+		if ( ntp.rx < sizeof ntp.rxbuf )
+			((char *)ntp.rxbuf)[ntp.rx++] = ch;
 	}
 }
 
@@ -113,40 +124,45 @@ rx_cb(int s,int ch) {
 //////////////////////////////////////////////////////////////////////
 
 static time_t
-ntp_time(const char *hostname) {
+ntp_time(ESP8266& esp,const char *hostname) {
 	static const uint64_t ntp_offset = ((uint64_t(365)*70)+17)*24*60*60;
 	static const unsigned char reqmsg[48] = {010,0,0,0,0,0,0,0,0};
 	static const short port = 123;		// NTP
 	uint32_t ntp_time = 0;
+	s_ntprx ntp;
 	int s, rc;
 
 	// Get a socket
-	s = esp.udp_socket(hostname,port,rx_cb);
+	s = esp.udp_socket(hostname,port,rx_cb,-1,&ntp);
 	if ( s < 0 )
 		return 0;			// No socket
 
 	// Initialize RX
-	rxp = (char *)rxbuf;
-	rx = 0;
-	rx_done = false;
+	ntp.rx = 0;
+	ntp.rx_done = false;
 
 	// Write request datagram
 	rc = esp.write(s,(const char *)reqmsg,sizeof reqmsg);
-	assert(rc == sizeof reqmsg);
+	if ( rc != sizeof reqmsg ) {
+		if ( opt_verbose )
+			printf("%s: sending to %s\n",esp.strerror(),hostname);
+		esp.close(s);
+		return 0;			// Caller retries
+	}
 
 	// Wait for the response
 	{
 		time_t t0 = time(0);			// This is valid only for POSIX systems
 
-		while ( !rx_done && time(0) - t0 < 5 )
+		while ( !ntp.rx_done && time(0) - t0 < 5 )
 			esp.receive();
 		esp.close(s);
 
-		if ( !rx_done )
+		if ( !ntp.rx_done )
 			return 0;			// No response
 	}
 
-	ntp_time = ntohl(rxbuf[10]);
+	ntp_time = ntohl(ntp.rxbuf[10]);
 
 	// Convert to Unix epoch time:
 	time_t uxtime = uint64_t(ntp_time) - ntp_offset;
@@ -193,7 +209,7 @@ int
 main(int argc,char **argv) {
 	static const char options[] = ":b:d:vh";
 	termios ios, svios;
-	int rc, optch, er = 0;
+	int fd, rc, optch, er = 0;
 
 	//////////////////////////////////////////////////////////////
 	// Parse command line options
@@ -269,6 +285,11 @@ main(int argc,char **argv) {
 	// Start execution
 	//////////////////////////////////////////////////////////////
 
+	ESP8266 esp(writeb,readb,rpoll,idle,&fd);
+
+	esp.get_io().set_clock(millis);
+	esp.set_retry(5,50,1000);		// Ride out "busy p..."
+
 	if ( !esp.start() ) {
 		fprintf(stderr,"Unable to start ESP8266\n");
 		exit(3);
@@ -278,7 +299,7 @@ main(int argc,char **argv) {
 
 	if ( optind < argc ) {
 		for ( ; optind < argc; ++optind ) {
-			while ( !ntp_time(argv[optind]) ) {
+			while ( !ntp_time(esp,argv[optind]) ) {
 				sleep(2);
 				printf("Retrying %s\n",argv[optind]);
 			}
@@ -286,12 +307,15 @@ main(int argc,char **argv) {
 	} else	{
 		const char *srv = "time.nrc.ca";
 
-		while ( !ntp_time(srv) ) {
+		while ( !ntp_time(esp,srv) ) {
 			sleep(2);
 			printf("Retrying %s\n",srv);
 		}
 	}
 
+	if ( opt_verbose )
+		printf("Command retries %lu, failed after retries %lu\n",esp.get_retries(),esp.get_giveups());
+
 	rc = tcsetattr(fd,TCSADRAIN,&svios);
 	close(fd);
 	return 0;
@@ -0,0 +1,225 @@
+///////////////////////////////////////////////////////////////////////
+// esppcap.cpp -- Capture ESP8266 socket traffic to a pcap file
+// Date: Sun Oct 18 10:12:41 2026
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "esppcap.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Constructor
+//////////////////////////////////////////////////////////////////////
+
+ESPPcap::ESPPcap() : f(0), esp(0), local_addr(0), frames(0) {
+	seg[0].len = seg[1].len = 0;
+}
+
+ESPPcap::~ESPPcap() {
+	close();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Open the pcap file and write its global header. The station_ip
+// is our address as returned by ESP8266::get_station_info().
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPPcap::open(const char *path,ESP8266& esp,const char *station_ip) {
+	struct {
+		unsigned int	magic;
+		unsigned short	major, minor;
+		int		thiszone;
+		unsigned int	sigfigs;
+		unsigned int	snaplen;
+		unsigned int	network;
+	} hdr = { 0xA1B2C3D4, 2, 4, 0, 0, 65535, 101 };	// 101 = LINKTYPE_RAW (IPv4)
+
+	close();
+
+	f = fopen(path,"wb");
+	if ( !f )
+		return false;
+
+	if ( fwrite(&hdr,sizeof hdr,1,f) != 1 ) {
+		fclose(f);
+		f = 0;
+		return false;
+	}
+
+	this->esp = &esp;
+	local_addr = str2ip(station_ip);
+	seg[0].len = seg[1].len = 0;
+	frames = 0;
+
+	for ( int x=0; x<N_CONNECTION; ++x )
+		seqno[x][0] = seqno[x][1] = 1;
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Close the capture file
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPPcap::close() {
+
+	if ( f ) {
+		fclose(f);
+		f = 0;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Store big endian values
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPPcap::put16(unsigned char *bp,unsigned v) {
+	bp[0] = v >> 8;
+	bp[1] = v;
+}
+
+void
+ESPPcap::put32(unsigned char *bp,unsigned long v) {
+	bp[0] = v >> 24;
+	bp[1] = v >> 16;
+	bp[2] = v >> 8;
+	bp[3] = v;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Internet checksum helpers
+//////////////////////////////////////////////////////////////////////
+
+unsigned long
+ESPPcap::sum(const unsigned char *bp,int len,unsigned long acc) {
+
+	for ( ; len > 1; bp += 2, len -= 2 )
+		acc += (bp[0] << 8) | bp[1];
+	if ( len > 0 )
+		acc += bp[0] << 8;
+	return acc;
+}
+
+unsigned
+ESPPcap::cksum(unsigned long acc) {
+
+	while ( acc >> 16 )
+		acc = (acc & 0xFFFF) + (acc >> 16);
+	return ~acc & 0xFFFF;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write one synthetic IPv4 frame carrying data
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPPcap::frame(int sock,bool tx,const unsigned char *data,int len) {
+	unsigned char hdr[40];
+	unsigned long raddr = 0, saddr, daddr;
+	int rport = 0, lport = 0, sport, dport, hlen;
+	bool udp = false;
+	struct timeval tv;
+
+	if ( !f || sock < 0 || sock >= N_CONNECTION )
+		return;
+
+	esp->get_peer(sock,raddr,rport,lport,udp);
+	if ( !lport )
+		lport = 49152 + sock;		// Ephemeral port is not reported by the ESP
+
+	if ( tx ) {
+		saddr = local_addr;
+		sport = lport;
+		daddr = raddr;
+		dport = rport;
+	} else	{
+		saddr = raddr;
+		sport = rport;
+		daddr = local_addr;
+		dport = lport;
+	}
+
+	hlen = udp ? 28 : 40;
+	memset(hdr,0,sizeof hdr);
+
+	// IPv4 header
+	hdr[0] = 0x45;
+	put16(hdr+2,hlen + len);
+	put16(hdr+4,frames);
+	put16(hdr+6,0x4000);			// Don't fragment
+	hdr[8] = 64;				// TTL
+	hdr[9] = udp ? 17 : 6;
+	put32(hdr+12,saddr);
+	put32(hdr+16,daddr);
+	put16(hdr+10,cksum(sum(hdr,20,0)));
+
+	// Pseudo header sum for TCP/UDP checksum
+	unsigned long acc = sum(hdr+12,8,0) + hdr[9] + (hlen - 20 + len);
+
+	put16(hdr+20,sport);
+	put16(hdr+22,dport);
+
+	if ( udp ) {
+		put16(hdr+24,8 + len);
+	} else	{
+		unsigned long& seq = seqno[sock][tx ? 1 : 0];
+		unsigned long& ack = seqno[sock][tx ? 0 : 1];
+
+		put32(hdr+24,seq);
+		put32(hdr+28,ack);
+		hdr[32] = 5 << 4;		// Data offset
+		hdr[33] = 0x18;			// PSH + ACK
+		put16(hdr+34,65535);		// Window
+		seq += len;
+	}
+
+	acc = sum(hdr+20,hlen-20,acc);
+	acc = sum(data,len,acc);
+	put16(hdr + (udp ? 26 : 36),cksum(acc));
+
+	gettimeofday(&tv,0);
+
+	unsigned int rec[4] = {
+		(unsigned int)tv.tv_sec,
+		(unsigned int)tv.tv_usec,
+		(unsigned int)(hlen + len),
+		(unsigned int)(hlen + len)
+	};
+
+	fwrite(rec,sizeof rec,1,f);
+	fwrite(hdr,hlen,1,f);
+	fwrite(data,len,1,f);
+	fflush(f);
+	++frames;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ESP8266 capture hook: collect bytes until ch == -1 ends a segment
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPPcap::capture(int sock,bool tx,int ch,void *user) {
+	ESPPcap *cap = (ESPPcap *)user;
+
+	if ( !cap )
+		return;				// set_capture() without its ESPPcap
+
+	s_seg& s = cap->seg[tx ? 1 : 0];
+
+	if ( ch != -1 ) {
+		s.data[s.len++] = ch;
+		if ( s.len < MaxSeg )
+			return;
+	}
+
+	if ( s.len > 0 )
+		cap->frame(sock,tx,s.data,s.len);
+	s.len = 0;
+}
+
+// End esppcap.cpp
@@ -0,0 +1,64 @@
+///////////////////////////////////////////////////////////////////////
+// esppcap.hpp -- Capture ESP8266 socket traffic to a pcap file
+// Date: Sun Oct 18 10:12:41 2026
+///////////////////////////////////////////////////////////////////////
+//
+// This POSIX helper turns the ESP8266 capture hook into synthetic
+// IPv4 TCP/UDP frames (LINKTYPE_RAW), so that socket traffic can be
+// examined with Wireshark or tcpdump -r. Our side of each frame uses
+// the station IP address (see ESP8266::get_station_info()), while
+// the remote side comes from ESP8266::get_peer(). Sockets opened by
+// host name (rather than dotted quad) show a remote of 0.0.0.0.
+//
+// All capture state (file, segments being collected, sequence numbers)
+// lives in the ESPPcap object, which the hook receives as its user
+// pointer, so each module of a process can have its own capture:
+//
+//	esp.set_capture(ESPPcap::capture,&pcap);
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef ESPPCAP_HPP
+#define ESPPCAP_HPP
+
+#include <stdio.h>
+
+#include "esp8266.hpp"
+
+class ESPPcap {
+	enum {
+		MaxSeg = 2048			// Largest captured segment
+	};
+
+	struct s_seg {
+		unsigned char	data[MaxSeg];	// Segment payload
+		int		len;		// Payload length
+	};
+
+	FILE		*f;			// Open pcap file, else nullptr
+	ESP8266		*esp;			// Device being captured
+	unsigned long	local_addr;		// Station IPv4 address
+	s_seg		seg[2];			// Segment being collected: [0]=rx, [1]=tx
+	unsigned long	seqno[N_CONNECTION][2];	// TCP sequence numbers: [0]=remote, [1]=local
+	unsigned long	frames;			// Frames written
+
+	void put16(unsigned char *bp,unsigned v);
+	void put32(unsigned char *bp,unsigned long v);
+	unsigned long sum(const unsigned char *bp,int len,unsigned long acc);
+	unsigned cksum(unsigned long acc);
+	void frame(int sock,bool tx,const unsigned char *data,int len);
+
+public:	ESPPcap();
+	~ESPPcap();
+
+	bool open(const char *path,ESP8266& esp,const char *station_ip);
+	void close();
+
+	inline unsigned long get_frames() const	{ return frames; }
+
+	static void capture(int sock,bool tx,int ch,void *user);	// ESP8266::capture_t hook (user=ESPPcap *)
+};
+
+#endif // ESPPCAP_HPP
+
+// End esppcap.hpp
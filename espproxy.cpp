@@ -0,0 +1,524 @@
+///////////////////////////////////////////////////////////////////////
+// espproxy.cpp -- Expose ESP8266 TCP connections as local endpoints
+// Date: Sun Oct 18 21:36:05 2026
+///////////////////////////////////////////////////////////////////////
+//
+// A daemon that owns the serial device and listens on a local UNIX
+// socket (-l path) or loopback TCP port (-l port). Each local client
+// is connected through the ESP8266 to host:port, so that unmodified
+// programs (curl, nc, ..) can use the module's uplink:
+//
+//	$ ./espproxy -d /dev/ttyUSB0 -l 8080 example.com 80 &
+//	$ curl -H 'Host: example.com' http://127.0.0.1:8080/
+//
+// Everything runs from one epoll loop, with only asynchronous ESP8266
+// operations. Whatever a client has written by the time the previous
+// send completes is coalesced into one AT+CIPSEND (up to 2048 bytes),
+// and the client is not read again until that send completes. Data
+// received from the module stays in the socket's ring until the client
+// can take it. If the ring overflows (the client reads slower than the
+// module receives), bytes are lost, so the connection is closed rather
+// than passing on a stream with holes. The ESP8266 cannot half-close,
+// so a client's EOF closes the whole connection.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "esp8266.hpp"
+#include "espserial.hpp"
+#include "espfd.hpp"
+
+static int opt_baudrate = 115200;
+static const char *opt_local = "8080";
+static bool opt_probe = false;
+static bool opt_verbose = false;
+static const char *opt_device = "/dev/cu.usbserial-A50285BI";
+static const char *opt_host = 0;
+static int opt_port = 0;
+
+enum {
+	SerialKey = N_CONNECTION,		// epoll keys: 0..N-1 are eventfds,
+	ListenKey,				// then these,
+	ClientKey				// then ClientKey + sock for clients
+};
+
+struct s_conn {				// One proxied connection, by ESP8266 socket
+	int		fd;			// Local client, else -1
+	bool		active;			// Socket in use (until close completes)
+	bool		open;			// ESP8266 connect completed
+	bool		closing;		// closeop submitted
+	bool		hup;			// Remote closed
+	unsigned	mask;			// Current epoll events for fd
+	ESP8266::AsyncOp sendop;		// Coalesced client data being sent
+	ESP8266::AsyncOp closeop;
+	char		txbuf[2048];		// Data for sendop
+	char		rxbuf[512];		// Data for the client
+	int		rxoff, rxlen;		// Unwritten part of rxbuf
+	unsigned long	overflows;		// get_rx_overflows() when accepted
+};
+
+static ESP8266 *esp = 0;
+static s_conn conns[N_CONNECTION];
+static int efd = -1;			// epoll descriptor
+
+//////////////////////////////////////////////////////////////////////
+// Set the epoll events for a client: read it unless a send is in
+// progress, and await writability while received data is pending
+//////////////////////////////////////////////////////////////////////
+
+static void
+update(int sock) {
+	s_conn& c = conns[sock];
+	struct epoll_event ev;
+
+	if ( c.fd < 0 )
+		return;
+
+	memset(&ev,0,sizeof ev);
+	if ( c.open && !c.closing && !c.sendop.done )
+		ev.events |= EPOLLIN;
+	if ( c.rxoff < c.rxlen )
+		ev.events |= EPOLLOUT;
+	if ( ev.events == c.mask )
+		return;
+
+	ev.data.u32 = ClientKey + sock;
+	epoll_ctl(efd,EPOLL_CTL_MOD,c.fd,&ev);
+	c.mask = ev.events;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Operation completions
+//////////////////////////////////////////////////////////////////////
+
+static void
+sent(ESP8266::AsyncOp& op,void *user) {
+	int sock = op.sock;
+
+	if ( op.result < 0 && opt_verbose )
+		printf("sock %d: send: %s\n",sock,esp->strerror(op.error));
+	op.done = 0;				// Send no longer in progress
+	update(sock);
+}
+
+static void
+closed(ESP8266::AsyncOp& op,void *user) {
+	s_conn& c = conns[op.sock];
+
+	if ( opt_verbose )
+		printf("sock %d: closed\n",op.sock);
+	if ( c.closing )			// Else already reused by a new client
+		c.active = false;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Close the ESP8266 socket (queued behind any send), and the client
+//////////////////////////////////////////////////////////////////////
+
+static void
+shut(int sock) {
+	s_conn& c = conns[sock];
+
+	if ( c.closing )
+		return;
+
+	c.closing = true;
+	if ( c.fd >= 0 ) {
+		close(c.fd);			// Also leaves the epoll set
+		c.fd = -1;
+	}
+
+	memset(&c.closeop,0,sizeof c.closeop);
+	c.closeop.kind = ESP8266::OpClose;
+	c.closeop.sock = sock;
+	c.closeop.done = closed;
+	esp->submit(c.closeop);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write received data to the client, until it would block
+//////////////////////////////////////////////////////////////////////
+
+static void
+flush_rx(int sock) {
+	s_conn& c = conns[sock];
+	unsigned long dropped = esp->get_rx_overflows(sock) - c.overflows;
+	int n;
+
+	if ( dropped > 0 ) {			// Ring overflowed: the stream has holes
+		fprintf(stderr,"sock %d: client too slow, %lu bytes lost: closed\n",sock,dropped);
+		shut(sock);
+		return;
+	}
+
+	while ( c.fd >= 0 ) {
+		if ( c.rxoff >= c.rxlen ) {
+			c.rxoff = 0;
+			if ( (c.rxlen = esp->recv(sock,c.rxbuf,sizeof c.rxbuf)) <= 0 ) {
+				c.rxlen = 0;
+				break;
+			}
+		}
+		if ( (n = write(c.fd,c.rxbuf+c.rxoff,c.rxlen-c.rxoff)) < 0 ) {
+			if ( errno != EAGAIN && errno != EWOULDBLOCK )
+				shut(sock);
+			break;
+		}
+		c.rxoff += n;
+	}
+
+	if ( c.hup && c.rxoff >= c.rxlen )
+		shut(sock);			// Remote closed, and all delivered
+	else	update(sock);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read what the client has written, and send it as one segment
+//////////////////////////////////////////////////////////////////////
+
+static void
+read_client(int sock) {
+	s_conn& c = conns[sock];
+	int n;
+
+	if ( c.fd < 0 || c.sendop.done )
+		return;
+
+	if ( !c.open ) {			// Hung up while connecting
+		close(c.fd);
+		c.fd = -1;			// Closed once the connect completes
+		return;
+	}
+
+	if ( (n = read(c.fd,c.txbuf,sizeof c.txbuf)) <= 0 ) {
+		if ( n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) )
+			shut(sock);		// Client EOF or error
+		return;
+	}
+
+	if ( opt_verbose )
+		printf("sock %d: send %d bytes\n",sock,n);
+
+	memset(&c.sendop,0,sizeof c.sendop);
+	c.sendop.kind = ESP8266::OpSend;
+	c.sendop.sock = sock;
+	c.sendop.str = c.txbuf;
+	c.sendop.len = n;
+	c.sendop.done = sent;
+	esp->submit(c.sendop);
+	update(sock);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Handle events noted for an ESP8266 socket
+//////////////////////////////////////////////////////////////////////
+
+static void
+sock_events(int sock,short events) {
+	s_conn& c = conns[sock];
+
+	if ( !c.active || c.closing )
+		return;
+
+	if ( events & ESP8266::PollErr ) {
+		if ( opt_verbose )
+			printf("sock %d: connect failed: %s\n",sock,esp->strerror(esp->get_sock_error(sock)));
+		shut(sock);
+		return;
+	}
+
+	if ( (events & ESP8266::PollOut) && !c.open ) {
+		if ( opt_verbose )
+			printf("sock %d: connected\n",sock);
+		c.open = true;
+		if ( c.fd < 0 )
+			shut(sock);		// Client already gone
+		else	update(sock);
+	}
+
+	if ( events & ESP8266::PollHup )
+		c.hup = true;
+	if ( events & (ESP8266::PollIn|ESP8266::PollHup) )
+		flush_rx(sock);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Accept a local client, and start its ESP8266 connection
+//////////////////////////////////////////////////////////////////////
+
+static void
+accept_client(int lfd) {
+	struct epoll_event ev;
+	int fd, sock;
+
+	if ( (fd = accept(lfd,0,0)) < 0 )
+		return;
+
+	fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) | O_NONBLOCK);
+	fcntl(fd,F_SETFD,FD_CLOEXEC);
+
+	if ( (sock = esp->tcp_connect_async(opt_host,opt_port,0)) < 0 ) {
+		if ( opt_verbose )
+			printf("Client refused: %s\n",esp->strerror(esp->get_error()));
+		close(fd);
+		return;
+	}
+
+	s_conn& c = conns[sock];
+
+	c.fd = fd;
+	c.active = true;
+	c.open = c.closing = c.hup = false;
+	c.mask = 0;
+	c.sendop.done = 0;
+	c.rxoff = c.rxlen = 0;
+	c.overflows = esp->get_rx_overflows(sock);
+
+	memset(&ev,0,sizeof ev);
+	ev.data.u32 = ClientKey + sock;
+	epoll_ctl(efd,EPOLL_CTL_ADD,fd,&ev);	// Events set once connected
+
+	if ( opt_verbose )
+		printf("sock %d: client accepted, connecting to %s:%d\n",sock,opt_host,opt_port);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Open the local listening socket: UNIX if local has a '/', else a
+// TCP port on the loopback address
+//////////////////////////////////////////////////////////////////////
+
+static int
+open_listen(const char *local) {
+	int fd;
+
+	if ( strchr(local,'/') ) {
+		struct sockaddr_un sun;
+
+		if ( strlen(local) >= sizeof sun.sun_path ) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		memset(&sun,0,sizeof sun);
+		sun.sun_family = AF_UNIX;
+		strcpy(sun.sun_path,local);
+		unlink(local);
+
+		if ( (fd = socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0)) < 0 )
+			return -1;
+		if ( bind(fd,(struct sockaddr *)&sun,sizeof sun) < 0 ) {
+			close(fd);
+			return -1;
+		}
+	} else	{
+		struct sockaddr_in sin;
+		int on = 1;
+
+		memset(&sin,0,sizeof sin);
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(atoi(local));
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if ( (fd = socket(AF_INET,SOCK_STREAM|SOCK_CLOEXEC,0)) < 0 )
+			return -1;
+		setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof on);
+		if ( bind(fd,(struct sockaddr *)&sin,sizeof sin) < 0 ) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	if ( listen(fd,N_CONNECTION) < 0 ) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Command line usage
+//////////////////////////////////////////////////////////////////////
+
+static void
+usage(const char *cmd) {
+	const char *cp = strrchr(cmd,'/');
+
+	if ( cp )
+		cmd = cp + 1;
+
+	fprintf(stderr,
+		"Usage: %s [-b baudrate] [-d device] [-l port|path] [-B] [-v] [-h] host port\n"
+		"where options include:\n"
+		"\t-b baudrate\tSerial baud rate (115200)\n"
+		"\t-d device\tSerial device pathname\n"
+		"\t-l port|path\tLocal loopback TCP port, or UNIX socket path (8080)\n"
+		"\t-B\t\tFind the module's baud rate, then raise it\n"
+		"\t-v\t\tVerbose output mode\n"
+		"\t-h\t\tThis help info.\n"
+		"Local clients are connected to host:port through the ESP8266.\n",
+		cmd);
+	exit(0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Proxy until interrupted
+//////////////////////////////////////////////////////////////////////
+
+int
+main(int argc,char **argv) {
+	static const char options[] = ":b:d:l:Bvh";
+	static char rxbufs[N_CONNECTION*2048];
+	struct epoll_event ev, evs[16];
+	ESPEventFd efds;
+	int optch, er = 0, lfd, n;
+
+	while ( (optch = getopt(argc,argv,options)) != -1 ) {
+		switch ( optch ) {
+		case 'b':
+			opt_baudrate = atoi(optarg);
+			break;
+		case 'd':
+			opt_device = optarg;
+			break;
+		case 'l':
+			opt_local = optarg;
+			break;
+		case 'B':
+			opt_probe = true;
+			break;
+		case 'v':
+			opt_verbose = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			break;
+		case ':':
+			fprintf(stderr,"Missing argument for -%c\n",optopt);
+			++er;
+			break;
+		default:
+			fprintf(stderr,"Invalid option -%c\n",optopt);
+			++er;
+		}
+	}
+
+	if ( argc - optind != 2 ) {
+		fprintf(stderr,"Expected host and port arguments.\n");
+		++er;
+	} else	{
+		opt_host = argv[optind];
+		opt_port = atoi(argv[optind+1]);
+	}
+
+	if ( er > 0 ) {
+		fprintf(stderr,"Use option -h for more information.\n");
+		exit(1);
+	}
+
+	signal(SIGPIPE,SIG_IGN);		// Client write errors are handled
+
+	ESPSerial serial;
+
+	if ( !serial.open(opt_device,opt_baudrate) ) {
+		fprintf(stderr,"%s: Opening serial device %s for r/w\n",
+			strerror(errno),
+			opt_device);
+		exit(3);
+	}
+
+	if ( opt_probe ) {
+		unsigned long t0 = ESPSerial::millis(0);
+
+		if ( !serial.probe_baud(true) ) {
+			fprintf(stderr,"No response from %s at any baud rate\n",opt_device);
+			exit(3);
+		}
+		if ( opt_verbose )
+			printf("Module at %d baud (probed in %lu ms)\n",
+				serial.get_baudrate(),ESPSerial::millis(0) - t0);
+	}
+
+	ESP8266 esp8266(ESPSerial::writeb,ESPSerial::readb,ESPSerial::rpoll,ESPSerial::idle,&serial);
+
+	esp = &esp8266;
+	esp8266.get_io().set_clock(ESPSerial::millis);
+	esp8266.set_rx_buffers(rxbufs,sizeof rxbufs);
+
+	if ( !esp8266.start() ) {
+		fprintf(stderr,"Unable to start ESP8266\n");
+		exit(3);
+	}
+
+	if ( (lfd = open_listen(opt_local)) < 0 ) {
+		fprintf(stderr,"%s: Listening on %s\n",strerror(errno),opt_local);
+		exit(4);
+	}
+
+	if ( (efd = epoll_create1(EPOLL_CLOEXEC)) == -1 || !efds.open(N_CONNECTION) ) {
+		fprintf(stderr,"%s: creating epoll/eventfd descriptors\n",strerror(errno));
+		exit(5);
+	}
+
+	esp8266.set_notify(ESPEventFd::notify,&efds);
+	serial.set_idle_wait(0);		// receive() must not block
+
+	for ( int sock=0; sock<N_CONNECTION; ++sock )
+		conns[sock].fd = -1;
+
+	memset(&ev,0,sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.u32 = SerialKey;
+	epoll_ctl(efd,EPOLL_CTL_ADD,serial.get_fd(),&ev);
+	ev.data.u32 = ListenKey;
+	epoll_ctl(efd,EPOLL_CTL_ADD,lfd,&ev);
+	for ( int sock=0; sock<N_CONNECTION; ++sock ) {
+		ev.data.u32 = sock;
+		epoll_ctl(efd,EPOLL_CTL_ADD,efds.get_fd(sock),&ev);
+	}
+
+	if ( opt_verbose )
+		printf("Proxying %s to %s:%d..\n",opt_local,opt_host,opt_port);
+
+	for (;;) {
+		if ( (n = epoll_wait(efd,evs,16,-1)) == -1 && errno != EINTR ) {
+			fprintf(stderr,"%s: epoll_wait()\n",strerror(errno));
+			exit(5);
+		}
+
+		for ( int x=0; x<n; ++x ) {
+			unsigned key = evs[x].data.u32;
+
+			if ( key == SerialKey )
+				esp8266.receive();
+			else if ( key == ListenKey )
+				accept_client(lfd);
+			else if ( key < unsigned(N_CONNECTION) )
+				sock_events(key,efds.take(key));
+			else	{
+				int sock = key - ClientKey;
+
+				if ( evs[x].events & EPOLLOUT )
+					flush_rx(sock);
+				if ( evs[x].events & (EPOLLIN|EPOLLHUP|EPOLLERR) )
+					read_client(sock);
+			}
+		}
+
+		esp8266.advance();		// Issue and progress operations
+	}
+
+	return 0;
+}
+
+// End espproxy.cpp
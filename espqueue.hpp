@@ -0,0 +1,67 @@
+///////////////////////////////////////////////////////////////////////
+// espqueue.hpp -- Lock-free single producer/consumer byte queue
+// Date: Sun Oct 18 18:40:12 2026
+///////////////////////////////////////////////////////////////////////
+//
+// ESPQueue is a bounded ring over a caller supplied buffer, whose size
+// must be a power of two. One thread (receive()) produces and one
+// thread (dispatch()) consumes, with no locks: each side owns one
+// index, and publishes it with a release store that the other side
+// reads with an acquire load (GCC __atomic builtins).
+//
+// The producer reserves room for a whole record, put()s its bytes and
+// then commit()s them, so the consumer never sees a partial record.
+// A record that does not fit is counted as an overflow and dropped.
+// A default constructed queue has no buffer until init().
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef ESPQUEUE_HPP
+#define ESPQUEUE_HPP
+
+#include <assert.h>
+
+class ESPQueue {
+	char		*buf;			// Ring storage
+	unsigned	mask;			// Size - 1
+	unsigned	head;			// Next byte to commit (producer)
+	unsigned	tail;			// Next byte to consume (consumer)
+	unsigned	headx;			// Next byte to put (producer)
+	unsigned long	overflows;		// Records dropped for lack of room
+
+public:	ESPQueue() : buf(0), mask(0), head(0), tail(0), headx(0), overflows(0) {}
+	ESPQueue(char *buf,unsigned size)	{ init(buf,size); }
+
+	inline void init(char *buf,unsigned size) {
+		assert(size > 0 && !(size & (size-1)));	// Power of two
+		this->buf = buf;
+		mask = size - 1;
+		head = tail = headx = 0;
+		overflows = 0;
+	}
+	inline unsigned size() const		{ return buf ? mask + 1 : 0; }
+	inline void reset()			{ head = tail = headx = 0; }	// Discard (neither side active)
+
+	// Producer side
+	inline bool reserve(unsigned bytes) {
+		if ( bytes > mask + 1 - (head - __atomic_load_n(&tail,__ATOMIC_ACQUIRE)) ) {
+			__atomic_store_n(&overflows,overflows+1,__ATOMIC_RELAXED);
+			return false;
+		}
+		headx = head;
+		return true;
+	}
+	inline void put(char b)			{ buf[headx++ & mask] = b; }
+	inline void commit()			{ __atomic_store_n(&head,headx,__ATOMIC_RELEASE); }
+
+	// Consumer side
+	inline unsigned available() const	{ return __atomic_load_n(&head,__ATOMIC_ACQUIRE) - tail; }
+	inline char peek(unsigned offset) const	{ return buf[(tail + offset) & mask]; }
+	inline void consume(unsigned bytes)	{ __atomic_store_n(&tail,tail+bytes,__ATOMIC_RELEASE); }
+
+	inline unsigned long get_overflows() const { return __atomic_load_n(&overflows,__ATOMIC_RELAXED); }
+};
+
+#endif // ESPQUEUE_HPP
+
+// End espqueue.hpp
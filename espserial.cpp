@@ -0,0 +1,377 @@
+///////////////////////////////////////////////////////////////////////
+// espserial.cpp -- Buffered POSIX serial transport for ESP8266
+// Date: Sun Oct 18 14:02:10 2026
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <assert.h>
+
+#include "espserial.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Constructor
+//////////////////////////////////////////////////////////////////////
+
+ESPSerial::ESPSerial()
+	: fd(-1), baudrate(0), bufx(0), buflen(0), idle_ms(10), failed(false), uart_flow(-1),
+	  rx_bytes(0), tx_bytes(0), rx_reads(0) {
+}
+
+ESPSerial::~ESPSerial() {
+	close();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Open the serial device in raw mode with hardware flow control
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPSerial::open(const char *device,int baudrate) {
+	struct termios ios;
+
+	close();
+
+	fd = ::open(device,O_RDWR|O_NOCTTY|O_NONBLOCK);
+	if ( fd == -1 )
+		return false;
+
+	if ( tcgetattr(fd,&ios) == -1 ) {
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+
+	svios = ios;
+	cfmakeraw(&ios);
+	cfsetspeed(&ios,baudrate);
+	ios.c_cflag |= CRTSCTS;		// Hardware flow control on
+
+	if ( tcsetattr(fd,TCSADRAIN,&ios) == -1 ) {
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+
+	this->baudrate = baudrate;
+	bufx = buflen = 0;
+	failed = false;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Change the host's baud rate, discarding unread input
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPSerial::set_baudrate(int baudrate) {
+	struct termios ios;
+
+	if ( fd < 0 || tcgetattr(fd,&ios) == -1 )
+		return false;
+	if ( cfsetspeed(&ios,baudrate) == -1 || tcsetattr(fd,TCSADRAIN,&ios) == -1 )
+		return false;
+
+	tcflush(fd,TCIFLUSH);
+	bufx = buflen = 0;
+	this->baudrate = baudrate;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Send cmd and wait up to ms for "OK" (anything else is skipped)
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPSerial::command_ok(const char *cmd,int ms) {
+	static const char ok[] = "OK\r\n";
+	unsigned long t0 = millis(this);
+	int match = 0;
+	long left;
+
+	tcflush(fd,TCIFLUSH);
+	bufx = buflen = 0;
+	put(cmd,strlen(cmd));
+
+	for (;;) {
+		while ( pending() ) {
+			char b = buf[bufx++];
+
+			if ( b == ok[match] ) {
+				if ( !ok[++match] )
+					return true;
+			} else	match = b == ok[0] ? 1 : 0;
+		}
+		if ( (left = ms - long(millis(this) - t0)) <= 0 || fill() < 0 )
+			return false;
+		if ( !pending() )
+			wait(POLLIN,int(left));
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Ask the module for its flow control: AT+UART_CUR? answers
+// +UART_CUR:<baud>,8,1,0,<flow>. Returns -1 if it does not answer.
+//////////////////////////////////////////////////////////////////////
+
+int
+ESPSerial::query_flow(int ms) {
+	static const char tag[] = "+UART_CUR:";
+	unsigned long t0 = millis(this);
+	int match = 0, commas = -1, fc = -1;
+	long left;
+
+	tcflush(fd,TCIFLUSH);
+	bufx = buflen = 0;
+	put("AT+UART_CUR?\r\n",14);
+
+	for (;;) {
+		while ( pending() ) {
+			char b = buf[bufx++];
+
+			if ( commas < 0 ) {
+				if ( b == tag[match] ) {
+					if ( !tag[++match] )
+						commas = 0;
+				} else	match = b == tag[0] ? 1 : 0;
+			} else if ( b == ',' ) {
+				++commas;
+			} else if ( commas == 4 && b >= '0' && b <= '3' ) {
+				fc = b - '0';
+			} else if ( b == '\r' || b == '\n' ) {
+				return fc;	// End of the +UART_CUR line
+			}
+		}
+		if ( (left = ms - long(millis(this) - t0)) <= 0 || fill() < 0 )
+			return -1;
+		if ( !pending() )
+			wait(POLLIN,int(left));
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Probe rates (fastest first, 0 terminated) with "AT", waiting up to
+// ms at each, and keep the first that answers OK. With upgrade, then
+// move to the fastest faster rate that works. Returns the final rate,
+// else 0 (with the rate restored to the one opened with).
+//////////////////////////////////////////////////////////////////////
+
+const int ESPSerial::baud_rates[] = {
+	921600, 460800, 230400, 115200, 57600, 38400, 19200, 9600, 0
+};
+
+int
+ESPSerial::probe_baud(bool upgrade,const int *rates,int ms) {
+	int orig = baudrate, x;
+
+	for ( x=0; rates[x] > 0; ++x )
+		if ( set_baudrate(rates[x]) && command_ok("\r\nAT\r\n",ms) )
+			break;
+
+	if ( rates[x] <= 0 ) {
+		set_baudrate(orig);
+		return 0;
+	}
+
+	if ( upgrade ) {
+		for ( int y=0; y<x; ++y ) {
+			if ( raise_baud(rates[y],ms) )
+				break;
+			if ( !command_ok("AT\r\n",ms) )	// Lost the module:
+				return probe_baud(false,rates,ms); // find it again
+		}
+	}
+	return baudrate;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Move the module (AT+UART_CUR, not saved) and then the host to rate
+// to, and confirm with "AT". On failure the host returns to its rate.
+// The module's flow control is kept (uart_flow, else AT+UART_CUR?).
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPSerial::raise_baud(int to,int ms) {
+	int from = baudrate, fc = uart_flow;
+	char cmd[48];
+
+	if ( !set_baudrate(to) || !set_baudrate(from) )
+		return false;			// Host cannot do it
+
+	if ( fc < 0 && (fc = uart_flow = query_flow(ms)) < 0 )
+		fc = 0;				// No answer: module default
+
+	snprintf(cmd,sizeof cmd,"AT+UART_CUR=%d,8,1,0,%d\r\n",to,fc);
+	if ( !command_ok(cmd,ms) )
+		return false;
+
+	tcdrain(fd);
+	usleep(2000);				// Module switches after its OK
+	if ( set_baudrate(to) && command_ok("AT\r\n",ms) )
+		return true;
+
+	set_baudrate(from);
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Restore the terminal settings and close the device
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPSerial::close() {
+
+	if ( fd >= 0 ) {
+		tcsetattr(fd,TCSADRAIN,&svios);
+		::close(fd);
+		fd = -1;
+	}
+	bufx = buflen = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Wait up to ms milliseconds for events (-1 waits forever)
+//////////////////////////////////////////////////////////////////////
+
+bool
+ESPSerial::wait(short events,int ms) {
+	struct pollfd p = { fd, events, 0 };
+	int rc;
+
+	do	{
+		rc = poll(&p,1,ms);
+	} while ( rc == -1 && errno == EINTR );
+
+	return rc == 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read whatever is available without blocking. Returns the number of
+// bytes now buffered, or -1 if the device failed.
+//////////////////////////////////////////////////////////////////////
+
+int
+ESPSerial::fill() {
+	int rc;
+
+	if ( bufx >= buflen )
+		bufx = buflen = 0;
+
+	if ( buflen >= int(sizeof buf) )
+		return buflen - bufx;		// Buffer is full
+
+	do	{
+		rc = read(fd,buf+buflen,sizeof buf-buflen);
+	} while ( rc == -1 && errno == EINTR );
+
+	if ( rc > 0 ) {
+		buflen += rc;
+		rx_bytes += rc;
+		++rx_reads;
+	} else if ( rc == 0 || errno != EAGAIN ) {
+		failed = true;			// POLLHUP would now wake us at once
+		return -1;
+	}
+
+	return buflen - bufx;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write one byte
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPSerial::put(char b) {
+	int rc;
+
+	for (;;) {
+		rc = write(fd,&b,1);
+		if ( rc == 1 )
+			break;
+		if ( rc == -1 && errno == EAGAIN )
+			wait(POLLOUT,-1);
+		else	assert(rc == -1 && errno == EINTR);
+	}
+	++tx_bytes;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write bytes (in as few write(2) calls as the device allows)
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPSerial::put(const char *data,int bytes) {
+	int rc;
+
+	while ( bytes > 0 ) {
+		rc = write(fd,data,bytes);
+		if ( rc > 0 ) {
+			data += rc;
+			bytes -= rc;
+			tx_bytes += rc;
+		} else if ( rc == -1 && errno == EAGAIN )
+			wait(POLLOUT,-1);
+		else	assert(rc == -1 && errno == EINTR);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// ESP8266 I/O callbacks
+//////////////////////////////////////////////////////////////////////
+
+void
+ESPSerial::writeb(char b,void *user) {
+	((ESPSerial *)user)->put(b);
+}
+
+void
+ESPSerial::writebuf(const char *data,int bytes,void *user) {
+	((ESPSerial *)user)->put(data,bytes);
+}
+
+char
+ESPSerial::readb(void *user) {
+	ESPSerial& ser = *(ESPSerial *)user;
+
+	while ( !ser.pending() ) {
+		if ( ser.fill() > 0 )
+			break;
+		if ( ser.failed )
+			return '\n';		// Ends the line being parsed
+		ser.wait(POLLIN,-1);
+	}
+	return ser.buf[ser.bufx++];
+}
+
+bool
+ESPSerial::rpoll(void *user) {
+	ESPSerial& ser = *(ESPSerial *)user;
+
+	return ser.pending() || ser.fill() > 0;
+}
+
+void
+ESPSerial::idle(void *user) {
+	ESPSerial& ser = *(ESPSerial *)user;
+
+	if ( ser.idle_ms > 0 && !ser.pending() ) {
+		if ( ser.failed )
+			usleep(ser.idle_ms * 1000);	// Don't spin on POLLHUP
+		else	ser.wait(POLLIN,ser.idle_ms);
+	}
+}
+
+unsigned long
+ESPSerial::millis(void *user) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
+
+// End espserial.cpp
@@ -0,0 +1,96 @@
+///////////////////////////////////////////////////////////////////////
+// espserial.hpp -- Buffered POSIX serial transport for ESP8266
+// Date: Sun Oct 18 14:02:10 2026
+///////////////////////////////////////////////////////////////////////
+//
+// ESPSerial owns one serial device and provides the ESP8266 I/O
+// callbacks for it. Pass the ESPSerial object as the user pointer:
+//
+//	ESPSerial serial;
+//	serial.open("/dev/ttyUSB0",115200);
+//	ESP8266 esp(ESPSerial::writeb,ESPSerial::readb,ESPSerial::rpoll,
+//		ESPSerial::idle,&serial);
+//
+// Reads are buffered, so one read(2) serves many readb() calls. When
+// no data is pending, idle() blocks in poll(2) for up to idle_ms
+// (instead of a busy usleep loop).
+//
+// Auto-baud: a module left at another baud rate is found with
+// probe_baud() before the ESP8266 object is used. It tries each rate
+// (fastest first) with "AT", and stays at the first that answers OK.
+// With upgrade, the module is then moved to the fastest rate the host
+// accepts that also answers (AT+UART_CUR, which a reset undoes):
+//
+//	if ( !serial.probe_baud(true) ) ... no answer at any rate
+//
+// The upgrade keeps the module's flow control: it is read back with
+// AT+UART_CUR? unless set_uart_flow() gives it (0 none .. 3 RTS/CTS).
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef ESPSERIAL_HPP
+#define ESPSERIAL_HPP
+
+#include <termios.h>
+
+class ESPSerial {
+	enum {
+		BufSize = 512			// Read buffer size
+	};
+
+	int		fd;			// Open serial device, else -1
+	int		baudrate;		// Current baud rate
+	struct termios	svios;			// Saved terminal settings
+	char		buf[BufSize];		// Read buffer
+	int		bufx;			// Next byte in buf[]
+	int		buflen;			// Bytes in buf[]
+	int		idle_ms;		// Max wait in idle()
+	bool		failed;			// Device hung up or read failed
+	int		uart_flow;		// AT+UART_CUR flow control, else -1 (ask)
+
+	unsigned long	rx_bytes;		// Bytes read from device
+	unsigned long	tx_bytes;		// Bytes written to device
+	unsigned long	rx_reads;		// read(2) calls returning data
+
+	bool wait(short events,int ms);		// poll(2) for events
+	bool command_ok(const char *cmd,int ms);	// Send cmd, await "OK" for ms
+	int query_flow(int ms);			// Module flow control, else -1
+	bool raise_baud(int to,int ms);		// Move module and host to rate to
+
+public:	ESPSerial();
+	~ESPSerial();
+
+	bool open(const char *device,int baudrate);
+	void close();
+
+	inline int get_fd() const		{ return fd; }
+	inline int get_baudrate() const		{ return baudrate; }
+	inline bool pending() const		{ return bufx < buflen; }
+	inline bool is_failed() const		{ return failed; }	// Hung up: readb() returns LF
+	bool set_baudrate(int baudrate);	// Change the host rate (input flushed)
+
+	static const int baud_rates[];		// Default probe_baud() rates, 0 terminated
+	int probe_baud(bool upgrade=false,const int *rates=baud_rates,int ms=40); // Final rate, else 0
+	inline void set_idle_wait(int ms)	{ idle_ms = ms; }
+	inline void set_uart_flow(int fc)	{ uart_flow = fc; }	// For probe_baud() upgrades
+
+	int fill();				// Read available data (non-blocking)
+	void put(char b);			// Write one byte
+	void put(const char *data,int bytes);	// Write bytes
+
+	inline unsigned long get_rx_bytes() const { return rx_bytes; }
+	inline unsigned long get_tx_bytes() const { return tx_bytes; }
+	inline unsigned long get_rx_reads() const { return rx_reads; }
+
+	// ESP8266 I/O callbacks (user is the ESPSerial *)
+	static void writeb(char b,void *user);
+	static void writebuf(const char *data,int bytes,void *user);	// For ESP8266FuncIo::set_writebuf()
+	static char readb(void *user);
+	static bool rpoll(void *user);
+	static void idle(void *user);
+	static unsigned long millis(void *user);	// For ESP8266FuncIo::set_clock()
+};
+
+#endif // ESPSERIAL_HPP
+
+// End espserial.hpp
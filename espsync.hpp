@@ -0,0 +1,297 @@
+///////////////////////////////////////////////////////////////////////
+// espsync.hpp -- Event bits used by ESP8266 waits (RTOS portability)
+// Date: Sun Oct 18 17:31:20 2026
+///////////////////////////////////////////////////////////////////////
+//
+// ESPEvents holds the ESP8266 response flags (OK, FAIL, SEND OK, ">",
+// CONNECT etc.) as a word of event bits. receive() sets bits as the
+// responses arrive, and a caller blocks in wait(mask) until any of the
+// bits in mask are set. Bits stay set until cleared, so a response
+// that arrives before the caller waits is not lost.
+//
+// Without USING_RTOS, the ESP8266 class polls receive() itself and
+// never calls wait(). With USING_RTOS, define one of the following
+// ahead of #include "esp8266.hpp" (in all modules) to select the
+// backend:
+//
+//	ESP_SYNC_PTHREAD	POSIX mutex + condition variable
+//	ESP_SYNC_FREERTOS	FreeRTOS event group
+//	ESP_SYNC_MBED		mbed OS rtos::EventFlags
+//	(none)			Spin calling yield(), supplied by the
+//				application (as in ntp_rtos.cpp)
+//
+// The blocking backends define ESP_SYNC_BLOCKING, and also provide:
+//
+//	ESPLock		Recursive mutex serialising ESP8266 commands
+//	ESPThread	Runs the ESP8266 receive() loop in its own thread
+//
+// Without a blocking backend, ESPLock does nothing.
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef ESPSYNC_HPP
+#define ESPSYNC_HPP
+
+#if defined(USING_RTOS) && defined(ESP_SYNC_PTHREAD)
+
+//////////////////////////////////////////////////////////////////////
+// POSIX threads
+//////////////////////////////////////////////////////////////////////
+
+#include <pthread.h>
+#include <sched.h>
+
+#define ESP_SYNC_BLOCKING	1
+
+class ESPEvents {
+	mutable pthread_mutex_t	mutex;
+	pthread_cond_t		cond;
+	unsigned		bits;
+
+public:	ESPEvents() : bits(0) {
+		pthread_mutex_init(&mutex,0);
+		pthread_cond_init(&cond,0);
+	}
+	~ESPEvents() {
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&mutex);
+	}
+
+	inline unsigned get() const {
+		pthread_mutex_lock(&mutex);
+		unsigned b = bits;
+		pthread_mutex_unlock(&mutex);
+		return b;
+	}
+	inline void set(unsigned b) {
+		pthread_mutex_lock(&mutex);
+		bits |= b;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+	inline void clear(unsigned b) {
+		pthread_mutex_lock(&mutex);
+		bits &= ~b;
+		pthread_mutex_unlock(&mutex);
+	}
+	inline unsigned wait(unsigned mask) {
+		pthread_mutex_lock(&mutex);
+		while ( !(bits & mask) )
+			pthread_cond_wait(&cond,&mutex);
+		unsigned b = bits & mask;
+		pthread_mutex_unlock(&mutex);
+		return b;
+	}
+	static inline void relax()		{ sched_yield(); }
+};
+
+class ESPLock {
+	pthread_mutex_t	mutex;
+
+public:	ESPLock() {
+		pthread_mutexattr_t attr;
+
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&mutex,&attr);
+		pthread_mutexattr_destroy(&attr);
+	}
+	~ESPLock()				{ pthread_mutex_destroy(&mutex); }
+
+	inline void lock()			{ pthread_mutex_lock(&mutex); }
+	inline void unlock()			{ pthread_mutex_unlock(&mutex); }
+};
+
+class ESPThread {
+	pthread_t	thread;
+	bool		running;
+	void		(*func)(void *arg);
+	void		*arg;
+
+	static void *run(void *self) {
+		ESPThread& t = *(ESPThread *)self;
+		t.func(t.arg);
+		return 0;
+	}
+
+public:	ESPThread() : running(false), func(0), arg(0) {}
+
+	inline bool start(void (*func)(void *arg),void *arg) {
+		this->func = func;
+		this->arg = arg;
+		running = pthread_create(&thread,0,run,this) == 0;
+		return running;
+	}
+	inline void join() {
+		if ( running )
+			pthread_join(thread,0);
+		running = false;
+	}
+};
+
+#elif defined(USING_RTOS) && defined(ESP_SYNC_FREERTOS)
+
+//////////////////////////////////////////////////////////////////////
+// FreeRTOS event group (needs configUSE_16_BIT_TICKS=0, since more
+// than 8 bits are used)
+//////////////////////////////////////////////////////////////////////
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "event_groups.h"
+#include "semphr.h"
+
+#define ESP_SYNC_BLOCKING	1
+
+#ifndef ESP_SYNC_STACK
+#define ESP_SYNC_STACK		512			// Receive task stack (words)
+#endif
+#ifndef ESP_SYNC_PRIORITY
+#define ESP_SYNC_PRIORITY	(tskIDLE_PRIORITY+2)	// Receive task priority
+#endif
+
+class ESPEvents {
+	EventGroupHandle_t	group;
+
+public:	ESPEvents()				{ group = xEventGroupCreate(); }
+	~ESPEvents()				{ vEventGroupDelete(group); }
+
+	inline unsigned get() const		{ return xEventGroupGetBits(group); }
+	inline void set(unsigned b)		{ xEventGroupSetBits(group,b); }
+	inline void clear(unsigned b)		{ xEventGroupClearBits(group,b); }
+	inline unsigned wait(unsigned mask) {
+		return xEventGroupWaitBits(group,mask,pdFALSE,pdFALSE,portMAX_DELAY) & mask;
+	}
+	static inline void relax()		{ taskYIELD(); }
+};
+
+class ESPLock {
+	SemaphoreHandle_t	mutex;
+
+public:	ESPLock()				{ mutex = xSemaphoreCreateRecursiveMutex(); }
+	~ESPLock()				{ vSemaphoreDelete(mutex); }
+
+	inline void lock()			{ xSemaphoreTakeRecursive(mutex,portMAX_DELAY); }
+	inline void unlock()			{ xSemaphoreGiveRecursive(mutex); }
+};
+
+class ESPThread {
+	TaskHandle_t		task;
+	SemaphoreHandle_t	done;		// Given when func returns
+	void			(*func)(void *arg);
+	void			*arg;
+
+	static void run(void *self) {
+		ESPThread& t = *(ESPThread *)self;
+		t.func(t.arg);
+		xSemaphoreGive(t.done);
+		vTaskDelete(0);
+	}
+
+public:	ESPThread() : task(0), done(0), func(0), arg(0) {}
+
+	inline bool start(void (*func)(void *arg),void *arg) {
+		this->func = func;
+		this->arg = arg;
+		done = xSemaphoreCreateBinary();
+		return xTaskCreate(run,"esprx",ESP_SYNC_STACK,this,ESP_SYNC_PRIORITY,&task) == pdPASS;
+	}
+	inline void join() {
+		if ( done ) {
+			xSemaphoreTake(done,portMAX_DELAY);
+			vSemaphoreDelete(done);
+			done = 0;
+		}
+	}
+};
+
+#elif defined(USING_RTOS) && defined(ESP_SYNC_MBED)
+
+//////////////////////////////////////////////////////////////////////
+// mbed OS 5/6 event flags
+//////////////////////////////////////////////////////////////////////
+
+#include "mbed.h"
+
+#define ESP_SYNC_BLOCKING	1
+
+class ESPEvents {
+	mutable rtos::EventFlags flags;
+
+public:	inline unsigned get() const		{ return flags.get(); }
+	inline void set(unsigned b)		{ flags.set(b); }
+	inline void clear(unsigned b)		{ flags.clear(b); }
+	inline unsigned wait(unsigned mask) {
+		return flags.wait_any(mask,osWaitForever,false) & mask;
+	}
+	static inline void relax()		{ rtos::ThisThread::yield(); }
+};
+
+class ESPLock {
+	rtos::Mutex	mutex;			// mbed mutexes are recursive
+
+public:	inline void lock()			{ mutex.lock(); }
+	inline void unlock()			{ mutex.unlock(); }
+};
+
+class ESPThread {
+	rtos::Thread	thread;
+
+public:	inline bool start(void (*func)(void *arg),void *arg) {
+		return thread.start(mbed::callback(func,arg)) == osOK;
+	}
+	inline void join()			{ thread.join(); }
+};
+
+#else
+
+//////////////////////////////////////////////////////////////////////
+// No blocking backend: plain bits (with USING_RTOS, waits spin on
+// the application's yield())
+//////////////////////////////////////////////////////////////////////
+
+#ifdef USING_RTOS
+extern "C" {
+	void yield();
+}
+#endif
+
+class ESPEvents {
+	volatile unsigned	bits;
+
+public:	ESPEvents() : bits(0) {}
+
+	inline unsigned get() const		{ return bits; }
+	inline void set(unsigned b)		{ bits = bits | b; }
+	inline void clear(unsigned b)		{ bits = bits & ~b; }
+#ifdef USING_RTOS
+	inline unsigned wait(unsigned mask) {
+		while ( !(bits & mask) )
+			yield();
+		return bits & mask;
+	}
+	static inline void relax()		{ yield(); }
+#endif
+};
+
+class ESPLock {
+public:	inline void lock()			{ }
+	inline void unlock()			{ }
+};
+
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// Holds an ESPLock for the life of a scope
+//////////////////////////////////////////////////////////////////////
+
+class ESPGuard {
+	ESPLock&	lock;
+
+public:	ESPGuard(ESPLock& lock) : lock(lock)	{ lock.lock(); }
+	~ESPGuard()				{ lock.unlock(); }
+};
+
+#endif // ESPSYNC_HPP
+
+// End espsync.hpp
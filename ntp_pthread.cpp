@@ -0,0 +1,313 @@
+//////////////////////////////////////////////////////////////////////
+// ntp_pthread.cpp -- ESP8266 NTP Code (POSIX threads)
+// Date: Sun Oct 18 17:52:09 2026
+///////////////////////////////////////////////////////////////////////
+//
+// This is ntp_rtos.cpp using real POSIX threads: the thread started
+// by ESP8266::start_receiver() runs receive(), while -n worker threads
+// (default 1) share the module to query the time servers. Commands
+// are serialised by the ESP8266 command lock. Waiting calls block on
+// the ESPEvents condition variable (see espsync.hpp) instead of
+// spinning on yield(), and the receive thread blocks in poll(2)
+// inside ESPSerial::idle().
+//
+// The ESP8266 module must be compiled with the same USING_RTOS and
+// ESP_SYNC_PTHREAD macros (the Makefile builds esp8266_pthread.o for
+// this).
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#define USING_RTOS		1
+#define ESP_SYNC_PTHREAD	1
+#include "esp8266.hpp"
+#include "espserial.hpp"
+
+static bool opt_probe = false;
+static bool opt_verbose = false;
+static int opt_baudrate = 115200;
+static int opt_threads = 1;
+static const char *opt_device = "/dev/cu.usbserial-A50285BI";
+
+//////////////////////////////////////////////////////////////////////
+// UDP Receiving (rx_cb runs in the receive thread)
+//////////////////////////////////////////////////////////////////////
+
+struct s_ntprx {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;		// Signalled at end of datagram
+	uint32_t	rxbuf[12];	// NTP receiving buffer
+	unsigned	rx;		// Byte index into rxbuf
+	bool		rx_done;	// End of datagram seen
+};
+
+static void
+rx_cb(int s,int ch,void *arg) {
+	s_ntprx& ntp = *(s_ntprx *)arg;
+
+	pthread_mutex_lock(&ntp.mutex);
+	if ( ch == -1 ) {
+		ntp.rx_done = true;
+		pthread_cond_signal(&ntp.cond);
+	} else	{
+		if ( ntp.rx < sizeof ntp.rxbuf )
+			((char *)ntp.rxbuf)[ntp.rx++] = ch;
+	}
+	pthread_mutex_unlock(&ntp.mutex);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Query NTP time server
+//////////////////////////////////////////////////////////////////////
+
+static time_t
+ntp_time(ESP8266& esp,const char *hostname) {
+	static const uint64_t ntp_offset = ((uint64_t(365)*70)+17)*24*60*60;
+	static const unsigned char reqmsg[48] = {010,0,0,0,0,0,0,0,0};
+	static const short port = 123;		// NTP
+	uint32_t ntp_time = 0;
+	s_ntprx ntp;
+	struct timespec ts;
+	int s, rc;
+
+	pthread_mutex_init(&ntp.mutex,0);
+	pthread_cond_init(&ntp.cond,0);
+	ntp.rx = 0;
+	ntp.rx_done = false;
+
+	// Get a socket
+	s = esp.udp_socket(hostname,port,rx_cb,-1,&ntp);
+	if ( s < 0 )
+		return 0;			// No socket
+
+	// Write request datagram
+	rc = esp.write(s,(const char *)reqmsg,sizeof reqmsg);
+	if ( rc != sizeof reqmsg ) {
+		esp.close(s);
+		return 0;
+	}
+
+	// Wait up to 5 seconds for the response
+	clock_gettime(CLOCK_REALTIME,&ts);
+	ts.tv_sec += 5;
+
+	pthread_mutex_lock(&ntp.mutex);
+	while ( !ntp.rx_done )
+		if ( pthread_cond_timedwait(&ntp.cond,&ntp.mutex,&ts) == ETIMEDOUT )
+			break;
+	pthread_mutex_unlock(&ntp.mutex);
+
+	esp.close(s);
+
+	if ( !ntp.rx_done )
+		return 0;			// No response
+
+	ntp_time = ntohl(ntp.rxbuf[10]);
+
+	// Convert to Unix epoch time:
+	time_t uxtime = uint64_t(ntp_time) - ntp_offset;
+
+	// Simple UTC time calculation:
+	unsigned hour = uxtime % 86400ul / 3600ul;
+	unsigned min  = uxtime % 3600ul / 60ul;
+	unsigned secs = uxtime % 60;
+
+	printf("%02d:%02d:%02d UTC from %s\n",hour,min,secs,hostname);
+
+	// Compute system time difference
+	time_t td;
+	char tbuf[32];
+	td = time(0);
+	long sdiff = int64_t(td) - int64_t(uxtime);
+	printf("%+ld seconds off: %s\n",long(sdiff),ctime_r(&uxtime,tbuf));
+
+	return uxtime;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Command line usage
+//////////////////////////////////////////////////////////////////////
+
+static void
+usage(const char *cmd) {
+	const char *cp = strrchr(cmd,'/');
+
+	if ( cp )
+		cmd = cp + 1;
+
+	fprintf(stderr,
+		"Usage: %s [-b baudrate] [-d /dev/usbserial] [-n threads] [-B] [-v] [-h] [ntpserver1...]\n"
+		"where options include:\n"
+		"\t-b baudrate\tSerial baud rate (115200)\n"
+		"\t-d device\tSerial device pathname\n"
+		"\t-n threads\tWorker threads sharing the module (1)\n"
+		"\t-B\t\tFind the module's baud rate, then raise it\n"
+		"\t-v\t\tVerbose output mode\n"
+		"\t-h\t\tThis help info.\n",
+		cmd);
+	exit(0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Worker thread: query each server in turn
+//////////////////////////////////////////////////////////////////////
+
+struct s_worker {
+	ESP8266		*esp;
+	const char	**servers;
+	int		nservers;
+	pthread_t	thread;
+};
+
+static void *
+worker(void *arg) {
+	s_worker& w = *(s_worker *)arg;
+
+	for ( int x=0; x<w.nservers; ++x ) {
+		while ( !ntp_time(*w.esp,w.servers[x]) ) {
+			sleep(2);
+			printf("Retrying %s\n",w.servers[x]);
+		}
+	}
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Provide the name(s) of time servers on the command line
+//////////////////////////////////////////////////////////////////////
+
+int
+main(int argc,char **argv) {
+	static const char options[] = ":b:d:n:Bvh";
+	static const char *defserver[] = { "0.ca.pool.ntp.org" };
+	s_worker workers[16];
+	int optch, er = 0;
+
+	//////////////////////////////////////////////////////////////
+	// Parse command line options
+	//////////////////////////////////////////////////////////////
+
+	while ( (optch = getopt(argc,argv,options)) != -1 ) {
+		switch ( optch ) {
+		case 'b':
+			opt_baudrate = atoi(optarg);
+			break;
+		case 'd':
+			opt_device = optarg;
+			break;
+		case 'n':
+			opt_threads = atoi(optarg);
+			if ( opt_threads < 1 || opt_threads > 16 ) {
+				fprintf(stderr,"Invalid -n %s (1 to 16)\n",optarg);
+				++er;
+			}
+			break;
+		case 'B':
+			opt_probe = true;
+			break;
+		case 'v':
+			opt_verbose = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			break;
+		case ':':
+			fprintf(stderr,"Missing argument for -%c\n",optopt);
+			++er;
+			break;
+		default:
+			fprintf(stderr,"Invalid option -%c\n",optopt);
+			++er;
+		}
+	}
+
+	if ( er > 0 ) {
+		fprintf(stderr,"Use option -h for more information.\n");
+		exit(1);	// Command line option error(s)
+	}
+
+	if ( opt_baudrate < 300 || opt_baudrate > 115200 ) {
+		fprintf(stderr,"Invalid baud rate -b %d\n",opt_baudrate);
+		exit(2);
+	}
+
+	//////////////////////////////////////////////////////////////
+	// Open serial device
+	//////////////////////////////////////////////////////////////
+
+	ESPSerial serial;
+
+	if ( !serial.open(opt_device,opt_baudrate) ) {
+		fprintf(stderr,"%s: Opening serial device %s for r/w\n",
+			strerror(errno),
+			opt_device);
+		exit(3);
+	}
+
+	if ( opt_probe ) {
+		unsigned long t0 = ESPSerial::millis(0);
+
+		if ( !serial.probe_baud(true) ) {
+			fprintf(stderr,"No response from %s at any baud rate\n",opt_device);
+			exit(3);
+		}
+		if ( opt_verbose )
+			printf("Module at %d baud (probed in %lu ms)\n",
+				serial.get_baudrate(),ESPSerial::millis(0) - t0);
+	}
+
+	//////////////////////////////////////////////////////////////
+	// Start execution
+	//////////////////////////////////////////////////////////////
+
+	ESP8266 esp(ESPSerial::writeb,ESPSerial::readb,ESPSerial::rpoll,ESPSerial::idle,&serial);
+
+	serial.set_idle_wait(100);	// Receive thread wakes at least every 100 ms
+	esp.start_receiver();
+
+	if ( !esp.start() ) {
+		fprintf(stderr,"Unable to start ESP8266\n");
+		exit(3);
+	}
+
+	for ( int x=0; x<opt_threads; ++x ) {
+		s_worker& w = workers[x];
+
+		w.esp = &esp;
+		if ( optind < argc ) {
+			w.servers = (const char **)argv + optind;
+			w.nservers = argc - optind;
+		} else	{
+			w.servers = defserver;
+			w.nservers = 1;
+		}
+		pthread_create(&w.thread,0,worker,&w);
+	}
+
+	for ( int x=0; x<opt_threads; ++x )
+		pthread_join(workers[x].thread,0);
+
+	//////////////////////////////////////////////////////////////
+	// Stop the receiving thread
+	//////////////////////////////////////////////////////////////
+
+	esp.stop_receiver();
+
+	if ( opt_verbose )
+		printf("Serial: %lu bytes in %lu reads, %lu bytes written\n",
+			serial.get_rx_bytes(),serial.get_rx_reads(),serial.get_tx_bytes());
+
+	serial.close();
+	return 0;
+}
+
+// End ntp_pthread.cpp
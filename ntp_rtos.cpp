@@ -34,6 +34,8 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <assert.h>
+#include <stdint.h>
+#include <arpa/inet.h>
 
 #include "PCoroutine/pcoroutine.hpp"	// Simulates coroutine scheduling
 
@@ -42,23 +44,23 @@
 
 CR_Mutex cr_mutex(false);		// Non-preemptive scheduling
 
-static void writeb(char b);
-static char readb();
-static bool rpoll();
+static void writeb(char b,void *arg);
+static char readb(void *arg);
+static bool rpoll(void *arg);
+static void idle(void *arg);
 void yield();				// The new idle procedure
 
-static ESP8266 esp(writeb,readb,rpoll,yield);
-static int fd = -1;
 static bool opt_verbose = false;
 static int opt_baudrate = 115200;
 static const char *opt_device = "/dev/cu.usbserial-A50285BI";
 
 //////////////////////////////////////////////////////////////////////
-// Write byte callback
+// Write byte callback (arg points to the serial fd)
 //////////////////////////////////////////////////////////////////////
 
 static void
-writeb(char b) {
+writeb(char b,void *arg) {
+	int fd = *(int *)arg;
 	int rc;
 
 	do	{
@@ -72,7 +74,8 @@ writeb(char b) {
 //////////////////////////////////////////////////////////////////////
 
 static char
-readb() {
+readb(void *arg) {
+	int fd = *(int *)arg;
 	char b;
 	int rc;
 
@@ -89,11 +92,11 @@ readb() {
 //////////////////////////////////////////////////////////////////////
 
 static bool
-rpoll() {
+rpoll(void *arg) {
 	struct pollfd p;
 	int rc;
 
-	p.fd = fd;
+	p.fd = *(int *)arg;
 	p.events = POLLIN;
 	p.revents = 0;
 
@@ -114,23 +117,30 @@ yield() {
 	usleep(100);		// Under POSIX, don't heat the CPU
 }
 
+static void
+idle(void *arg) {
+	yield();
+}
+
 //////////////////////////////////////////////////////////////////////
 // UDP Receiving
 //////////////////////////////////////////////////////////////////////
 
-static uint32_t rxbuf[12];	// NTP receiving buffer
-static char *rxp = 0;		// rx_cb byte pointer within rxbuf
-static unsigned rx = 0;		// Index for rxp[rx]
-static bool rx_done = false;	// End of datagram seen
+struct s_ntprx {
+	uint32_t	rxbuf[12];	// NTP receiving buffer
+	unsigned	rx;		// Byte index into rxbuf
+	bool		rx_done;	// End of datagram seen
+};
 
 static void
-rx_cb(int s,int ch) {
+rx_cb(int s,int ch,void *arg) {
+	s_ntprx& ntp = *(s_ntprx *)arg;
 
 	if ( ch == -1 ) {
-		rx_done = true;
+		ntp.rx_done = true;
 	} else	{
-		if ( rx < sizeof rxbuf )
-			rxp[rx++] = ch;
+		if ( ntp.rx < sizeof ntp.rxbuf )
+			((char *)ntp.rxbuf)[ntp.rx++] = ch;
 	}
 }
 
@@ -139,26 +149,26 @@ rx_cb(int s,int ch) {
 //////////////////////////////////////////////////////////////////////
 
 static time_t
-ntp_time(const char *hostname) {
+ntp_time(ESP8266& esp,const char *hostname) {
 	static const uint64_t ntp_offset = ((uint64_t(365)*70)+17)*24*60*60;
 	static const unsigned char reqmsg[48] = {010,0,0,0,0,0,0,0,0};
 	static const short port = 123;		// NTP
 	uint32_t ntp_time = 0;
+	s_ntprx ntp;
 	int s, rc;
 
 	cr_mutex.yield();
 
 	// Get a socket
-	s = esp.udp_socket(hostname,port,rx_cb);
+	s = esp.udp_socket(hostname,port,rx_cb,-1,&ntp);
 	if ( s < 0 )
 		return 0;			// No socket
 
 	cr_mutex.yield();
 
 	// Initialize RX
-	rxp = (char *)rxbuf;
-	rx = 0;
-	rx_done = false;
+	ntp.rx = 0;
+	ntp.rx_done = false;
 
 	// Write request datagram
 	rc = esp.write(s,(const char *)reqmsg,sizeof reqmsg);
@@ -168,17 +178,17 @@ ntp_time(const char *hostname) {
 	{
 		time_t t0 = time(0);			// This is valid only for POSIX systems
 
-		while ( !rx_done && time(0) - t0 < 5 )
+		while ( !ntp.rx_done && time(0) - t0 < 5 )
 			cr_mutex.yield();		// Yield until a response
 		esp.close(s);
 
 		cr_mutex.yield();
 
-		if ( !rx_done )
+		if ( !ntp.rx_done )
 			return 0;			// No response
 	}
 
-	ntp_time = ntohl(rxbuf[10]);
+	ntp_time = ntohl(ntp.rxbuf[10]);
 
 	// Convert to Unix epoch time:
 	time_t uxtime = uint64_t(ntp_time) - ntp_offset;
@@ -246,7 +256,7 @@ int
 main(int argc,char **argv) {
 	static const char options[] = ":b:d:vh";
 	termios ios, svios;
-	int rc, optch, er = 0;
+	int fd, rc, optch, er = 0;
 
 	//////////////////////////////////////////////////////////////
 	// Parse command line options
@@ -322,6 +332,7 @@ main(int argc,char **argv) {
 	// Start execution
 	//////////////////////////////////////////////////////////////
 
+	ESP8266 esp(writeb,readb,rpoll,idle,&fd);
 	PCoroutine rx(cr_mutex,receiver,&esp);	// Start rx thread
 
 	if ( !esp.start() ) {
@@ -331,7 +342,7 @@ main(int argc,char **argv) {
 
 	if ( optind < argc ) {
 		for ( ; optind < argc; ++optind ) {
-			while ( !ntp_time(argv[optind]) ) {
+			while ( !ntp_time(esp,argv[optind]) ) {
 				sleep(2);
 				printf("Retrying %s\n",argv[optind]);
 			}
@@ -339,7 +350,7 @@ main(int argc,char **argv) {
 	} else	{
 		const char *srv = "0.ca.pool.ntp.org";
 
-		while ( !ntp_time(srv) ) {
+		while ( !ntp_time(esp,srv) ) {
 			sleep(2);
 			printf("Retrying %s\n",srv);
 		}
@@ -15,10 +15,13 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "esp8266.hpp"
-
-static ESP8266 *esp_ptr = 0;
+#include "esppcap.hpp"
+#include "espnetser.hpp"
+#include "espserial.hpp"
 
 static bool opt_verbose = false;
 static const char *opt_device = "/dev/cu.usbserial-A50285BI";
@@ -41,17 +44,30 @@ static int opt_listen = -1;
 static bool opt_reset = false;
 static bool opt_wait_wifi = false;
 static bool opt_Hardware_reset = false;
+static const char *opt_capture = 0;
+static int opt_queue = 0;
+static bool opt_async = false;
+static const char *opt_net = 0;
+static bool opt_rfc2217 = false;
+static const char *opt_file = 0;
+static bool opt_pacing = false;
+static bool opt_flow = false;
+static bool opt_probe = false;
+static bool opt_scan = false;
+static bool opt_fast = false;
 
-static int fd = -1;
 static struct termios ios;
 static FILE *output = 0;		// For opt_output
+static ESPPcap capture;			// For opt_capture
+static ESPNetSerial netser;		// For opt_net
 
 //////////////////////////////////////////////////////////////////////
-// Write one byte to the usb serial adapter
+// Write one byte to the usb serial adapter (arg points to the fd)
 //////////////////////////////////////////////////////////////////////
 
 static void
-writeb(char b) {
+writeb(char b,void *arg) {
+	int fd = *(int *)arg;
 	int rc;
 
 	do	{
@@ -60,12 +76,31 @@ writeb(char b) {
 	assert(rc==1);
 }
 
+//////////////////////////////////////////////////////////////////////
+// Write bytes to the usb serial adapter (one system call, if it fits)
+//////////////////////////////////////////////////////////////////////
+
+static void
+writebuf(const char *data,int bytes,void *arg) {
+	int fd = *(int *)arg;
+	int rc;
+
+	while ( bytes > 0 ) {
+		rc = write(fd,data,bytes);
+		if ( rc > 0 ) {
+			data += rc;
+			bytes -= rc;
+		} else	assert(rc == -1 && errno == EINTR);
+	}
+}
+
 //////////////////////////////////////////////////////////////////////
 // Read one byte from the usb serial adapter
 //////////////////////////////////////////////////////////////////////
 
 static char
-readb() {
+readb(void *arg) {
+	int fd = *(int *)arg;
 	char b;
 	int rc;
 
@@ -83,11 +118,11 @@ readb() {
 //////////////////////////////////////////////////////////////////////
 
 static bool
-rpoll() {
+rpoll(void *arg) {
 	struct pollfd p;
 	int rc;
 
-	p.fd = fd;
+	p.fd = *(int *)arg;
 	p.events = POLLIN;
 	p.revents = 0;
 
@@ -103,16 +138,29 @@ rpoll() {
 //////////////////////////////////////////////////////////////////////
 
 static void
-idle() {
+idle(void *arg) {
 	usleep(100);
 }
 
 //////////////////////////////////////////////////////////////////////
-// Used to receive response from tcp_connect() socket
+// Millisecond clock (for send pacing, -s)
+//////////////////////////////////////////////////////////////////////
+
+static unsigned long
+millis(void *arg) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Used to receive response from tcp_connect() socket (arg is FILE *)
 //////////////////////////////////////////////////////////////////////
 
 static void
-rx_callback(int sock,int byte) {
+rx_callback(int sock,int byte,void *arg) {
+	FILE *output = (FILE *)arg;
 
 	if ( byte == -1 ) {
 		printf("<Remote closed socket %d>\n",sock);
@@ -127,7 +175,7 @@ rx_callback(int sock,int byte) {
 //////////////////////////////////////////////////////////////////////
 
 static void
-udp_rx(int sock,int byte) {
+udp_rx(int sock,int byte,void *arg) {
 
 	if ( byte == -1 ) {
 		printf("<End of UDP packet>\n");
@@ -137,7 +185,7 @@ udp_rx(int sock,int byte) {
 }
 
 static void
-server_recv(int sock,int byte) {
+server_recv(int sock,int byte,void *arg) {
 
 	if ( byte == -1 ) {
 		printf("\nREMOTE CLOSED server socket %d\n",sock);
@@ -147,12 +195,24 @@ server_recv(int sock,int byte) {
 	}
 }
 
+//////////////////////////////////////////////////////////////////////
+// Asynchronous connect completed (option -a)
+//////////////////////////////////////////////////////////////////////
+
+static void
+connect_cb(int sock,ESP8266::Error err,void *arg) {
+
+	if ( opt_verbose )
+		printf("<Connect completed on socket %d: %s>\n",sock,err == ESP8266::Ok ? "ok" : "failed");
+}
+
 static void
-accept_cb(int sock) {
+accept_cb(int sock,void *arg) {
+	ESP8266& esp = *(ESP8266 *)arg;
 
 	if ( sock >= 0 ) {
 		printf("ACCEPTED server connect on sock = %d\n",sock);
-		esp_ptr->accept(sock,server_recv);
+		esp.accept(sock,server_recv);
 	} else	{
 		printf("SERVER has CLOSED due to reset.\n");
 	}
@@ -185,11 +245,22 @@ usage(const char *cmd) {
 		"\t-d device\tSerial device pathname\n"
 		"\t-j wifi_name\tWIFI network to join\n"
 		"\t-P password\tWIFI passord (for -j)\n"
+		"\t-J\t\tJoin (-j) only the current AP's BSSID\n"
 		"\t-o file\t\tSend received output to file (default is stdout)\n"
 		"\t-D {0|1}\tDisable/Enable DHCP\n"
 		"\t-A ipaddr\tSet AP IP Address\n"
 		"\t-T secs\t\tSet new timeout\n"
 		"\t-L port\t\tListen on port\n"
+		"\t-C file\t\tCapture socket traffic to pcap file\n"
+		"\t-q bytes\tQueue callbacks in a ring of bytes (power of 2)\n"
+		"\t-a\t\tConnect asynchronously (-c)\n"
+		"\t-n host:port\tUse a raw serial server instead of -d\n"
+		"\t-N host:port\tUse an RFC 2217 serial server instead of -d\n"
+		"\t-f file\t\tUpload file to the TCP host (-c), instead of GET /\n"
+		"\t-s\t\tPace sends to the module's drain rate\n"
+		"\t-F\t\tHave the module use RTS/CTS too (AT+UART_CUR)\n"
+		"\t-B\t\tFind the module's baud rate, then raise it (-d)\n"
+		"\t-l\t\tList access points (AT+CWLAP)\n"
 		"\t-v\t\tVerbose output mode\n"
 		"\t-h\t\tThis help info.\n"
 		"\n"
@@ -199,14 +270,68 @@ usage(const char *cmd) {
 	exit(0);
 }
 
+//////////////////////////////////////////////////////////////////////
+// Upload opt_file to sock: the file is mapped, and each AT+CIPSEND
+// segment is written straight from the mapping (see writebuf())
+//////////////////////////////////////////////////////////////////////
+
+static int
+upload(ESP8266& esp,int sock) {
+	struct timespec t0, t1;
+	struct stat st;
+	void *map = 0;
+	int fd, sent;
+
+	if ( (fd = open(opt_file,O_RDONLY)) == -1 || fstat(fd,&st) == -1 ) {
+		fprintf(stderr,"%s: opening %s for upload\n",strerror(errno),opt_file);
+		exit(14);
+	}
+
+	if ( st.st_size > 0x7FFFFFFF ) {
+		fprintf(stderr,"%s: too large for upload\n",opt_file);
+		exit(14);
+	} else if ( st.st_size > 0 ) {
+		map = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+		if ( map == MAP_FAILED ) {
+			fprintf(stderr,"%s: mapping %s\n",strerror(errno),opt_file);
+			exit(14);
+		}
+		madvise(map,st.st_size,MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	if ( st.st_size > 0 )
+		sent = esp.write(sock,(const char *)map,int(st.st_size));
+	else	sent = 0;			// Empty file: nothing to send
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+
+	double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	double limit = opt_baudrate / 10.0;		// Bytes/s for 8N1
+
+	if ( sent < 0 )
+		fprintf(stderr,"%s: uploading %s\n",esp.strerror(),opt_file);
+	else if ( secs > 0 )
+		printf("Uploaded %d bytes in %.3f s: %.0f bytes/s, %.1f%% of the %d baud UART limit (%.0f bytes/s)\n",
+			sent,secs,sent/secs,sent/secs*100.0/limit,opt_baudrate,limit);
+	if ( opt_verbose )
+		printf("Busy/SEND FAIL responses %lu, rate backoffs %lu, send rate %lu bytes/s%s\n",
+			esp.get_busy_count(),esp.get_backoffs(),esp.get_send_rate(),
+			esp.get_send_rate() ? "" : " (unpaced)");
+
+	if ( map )
+		munmap(map,st.st_size);
+	return sent;
+}
+
 //////////////////////////////////////////////////////////////////////
 // Test main program
 //////////////////////////////////////////////////////////////////////
 
 int
 main(int argc,char **argv) {
-	static const char options[] = ":RWc:u:U:P:b:d:j:p:rm:o:D:A:S:T:L:HZ:vh";
-	int rc, optch, er = 0;
+	static const char options[] = ":RWc:u:U:P:b:d:j:p:rm:o:D:A:S:T:L:HZ:C:q:an:N:f:sFBlJvh";
+	int fd, rc, optch, er = 0;
 
 	//////////////////////////////////////////////////////////////
 	// Parse command line options
@@ -283,6 +408,46 @@ main(int argc,char **argv) {
 		case 'Z':
 			opt_Z = atoi(optarg);
 			break;
+		case 'C':
+			opt_capture = optarg;
+			break;
+		case 'a':
+			opt_async = true;
+			break;
+		case 'f':
+			opt_file = optarg;
+			break;
+		case 's':
+			opt_pacing = true;
+			break;
+		case 'F':
+			opt_flow = true;
+			break;
+		case 'B':
+			opt_probe = true;
+			break;
+		case 'l':
+			opt_scan = true;
+			break;
+		case 'J':
+			opt_fast = true;
+			break;
+		case 'n':
+		case 'N':
+			opt_net = optarg;
+			opt_rfc2217 = optch == 'N';
+			if ( !strchr(optarg,':') ) {
+				fprintf(stderr,"Invalid -%c %s (host:port)\n",optch,optarg);
+				++er;
+			}
+			break;
+		case 'q':
+			opt_queue = atoi(optarg);
+			if ( opt_queue < 16 || (opt_queue & (opt_queue - 1)) ) {
+				fprintf(stderr,"Invalid -q %s (power of 2, >= 16)\n",optarg);
+				++er;
+			}
+			break;
 		case 'v':
 			opt_verbose = true;
 			break;
@@ -309,6 +474,12 @@ main(int argc,char **argv) {
 		exit(2);
 	}
 
+	if ( opt_probe && opt_net ) {
+		fprintf(stderr,"Option -B needs a serial device (-d), not -%c\n",
+			opt_rfc2217 ? 'N' : 'n');
+		exit(4);
+	}
+
 	if ( optind < argc ) {
 		fprintf(stderr,"Dangling command line arguments. Use -h for more info.\n");
 		exit(4);
@@ -332,34 +503,76 @@ main(int argc,char **argv) {
 	} else	output = stdout;
 
 	//////////////////////////////////////////////////////////////
-	// Open serial device
+	// Connect to the serial server (-n/-N)
 	//////////////////////////////////////////////////////////////
 
-	fd = open(opt_device,O_RDWR);
-	if ( fd == -1 ) {
-		fprintf(stderr,"%s: Opening serial device %s for r/w\n",
-			strerror(errno),
-			opt_device);
-		exit(3);
-	}
+	if ( opt_net ) {
+		const char *cp = strrchr(opt_net,':');
+		char host[256];
 
-	//////////////////////////////////////////////////////////////
-	// Setup device for raw I/O
-	//////////////////////////////////////////////////////////////
+		snprintf(host,sizeof host,"%.*s",int(cp-opt_net),opt_net);
+		if ( !netser.open(host,atoi(cp+1),opt_rfc2217 ? opt_baudrate : 0) ) {
+			fprintf(stderr,"%s: Connecting to serial server %s\n",
+				strerror(errno),
+				opt_net);
+			exit(3);
+		}
+		fd = -1;
+		opt_device = opt_net;
+	} else	{
+		//////////////////////////////////////////////////////////////
+		// Find the module's baud rate (-B), then open at that rate
+		//////////////////////////////////////////////////////////////
+
+		if ( opt_probe ) {
+			ESPSerial probe;
+			unsigned long t0 = ESPSerial::millis(0);
+
+			if ( !probe.open(opt_device,opt_baudrate) ) {
+				fprintf(stderr,"%s: Opening serial device %s for r/w\n",
+					strerror(errno),
+					opt_device);
+				exit(3);
+			}
+			if ( !(opt_baudrate = probe.probe_baud(true)) ) {
+				fprintf(stderr,"No response from %s at any baud rate\n",opt_device);
+				exit(3);
+			}
+			if ( opt_verbose )
+				fprintf(stderr,"Module at %d baud (probed in %lu ms)\n",
+					opt_baudrate,ESPSerial::millis(0) - t0);
+		}
 
-	rc = tcgetattr(fd,&ios);
-	assert(!rc);
-	cfmakeraw(&ios);
-	cfsetspeed(&ios,opt_baudrate);
-	ios.c_cflag |= CRTSCTS;		// Hardware flow control on
-
-	rc = tcsetattr(fd,TCSADRAIN,&ios);
-	if ( rc == -1 ) {
-		fprintf(stderr,"%s: setting raw device %s to baud_rate %d\n",
-			strerror(errno),
-			opt_device,
-			opt_baudrate);
-		exit(2);
+		//////////////////////////////////////////////////////////////
+		// Open serial device
+		//////////////////////////////////////////////////////////////
+
+		fd = open(opt_device,O_RDWR);
+		if ( fd == -1 ) {
+			fprintf(stderr,"%s: Opening serial device %s for r/w\n",
+				strerror(errno),
+				opt_device);
+			exit(3);
+		}
+
+		//////////////////////////////////////////////////////////////
+		// Setup device for raw I/O
+		//////////////////////////////////////////////////////////////
+
+		rc = tcgetattr(fd,&ios);
+		assert(!rc);
+		cfmakeraw(&ios);
+		cfsetspeed(&ios,opt_baudrate);
+		ios.c_cflag |= CRTSCTS;		// Hardware flow control on
+
+		rc = tcsetattr(fd,TCSADRAIN,&ios);
+		if ( rc == -1 ) {
+			fprintf(stderr,"%s: setting raw device %s to baud_rate %d\n",
+				strerror(errno),
+				opt_device,
+				opt_baudrate);
+			exit(2);
+		}
 	}
 
 	//////////////////////////////////////////////////////////////
@@ -370,10 +583,26 @@ main(int argc,char **argv) {
 		fprintf(stderr,"Opened %s for I/O at %d baud\n",
 			opt_device,opt_baudrate);
 
-	ESP8266 esp(writeb,readb,rpoll,idle);
-	esp_ptr = &esp;
+	ESP8266 esp(opt_net ? ESPNetSerial::writeb : writeb,
+		opt_net ? ESPNetSerial::readb : readb,
+		opt_net ? ESPNetSerial::rpoll : rpoll,
+		opt_net ? ESPNetSerial::idle : idle,
+		opt_net ? (void *)&netser : (void *)&fd);
+	ESPQueue *queue = 0;
+
+	esp.get_io().set_writebuf(opt_net ? ESPNetSerial::writebuf : writebuf);
+	esp.get_io().set_clock(opt_net ? ESPNetSerial::millis : millis);
+	if ( !esp.set_pacing(opt_pacing) )
+		fprintf(stderr,"Send pacing needs a clock (-s ignored)\n");
+	if ( opt_flow )
+		esp.set_flow_control(opt_baudrate);	// Applied by start()
 	bool ok;
 
+	if ( opt_queue > 0 ) {
+		queue = new ESPQueue(new char[opt_queue],opt_queue);
+		esp.set_queue(queue);
+	}
+
 	//////////////////////////////////////////////////////////////
 	// Initialize the device
 	//////////////////////////////////////////////////////////////
@@ -415,10 +644,13 @@ main(int argc,char **argv) {
 		if ( opt_join && opt_password ) {
 			if ( opt_verbose )
 				printf("Joining WIFI network -j %s\n",opt_join);
-			ok = esp.ap_join(opt_join,opt_password);
+			if ( opt_fast )
+				esp.is_wifi(false);	// Learns the AP's BSSID
+			ok = esp.ap_join(opt_join,opt_password,opt_fast);
 			if ( opt_verbose || !ok )
-				fprintf(stderr,"WIFI %s (-j)\n",
-					ok ? "ok" : "failed");
+				fprintf(stderr,"WIFI %s (-j) in %lu ms%s\n",
+					ok ? "ok" : "failed",esp.get_join_ms(),
+					esp.is_join_fast() ? " (BSSID pinned)" : "");
 			if ( !ok )
 				exit(13);
 		}
@@ -454,6 +686,24 @@ main(int argc,char **argv) {
 		
 	}
 
+	if ( opt_scan ) {
+		ESP8266::ApInfo aps[16], cache[16];
+		int n;
+
+		esp.set_scan_cache(cache,16);
+		n = esp.scan_aps(aps,16);
+		if ( n < 0 )
+			fprintf(stderr,"%s: Scanning access points (-l)\n",esp.strerror());
+		for ( int x = 0; x < n && x < 16; ++x )
+			printf("AP %-32s %s ch %2d %4d dBm ecn=%d\n",
+				aps[x].ssid,aps[x].mac,aps[x].channel,aps[x].rssi,int(aps[x].ecn));
+		if ( n >= 0 && opt_verbose ) {
+			n = esp.scan_aps(aps,16,5000);	// Reuses the scan above
+			printf("%d APs cached, %lu ms old\n",n,esp.get_scan_age());
+		}
+		esp.set_scan_cache(0,0);
+	}
+
 	if ( opt_ap_address ) {
 		ok = esp.set_ap_addr(opt_ap_address);
 		if ( !ok )
@@ -472,6 +722,16 @@ main(int argc,char **argv) {
 		if ( !ok )
 			fprintf(stderr,"Get Station Address Info failed.\n");
 		else	printf("Station IP='%s', gateway='%s', netmask='%s'\n",ip,gw,nmask);
+
+		if ( opt_capture ) {
+			if ( !capture.open(opt_capture,esp,ok ? ip : "0.0.0.0") ) {
+				fprintf(stderr,"%s: opening capture file %s\n",
+					strerror(errno),
+					opt_capture);
+				exit(5);
+			}
+			esp.set_capture(ESPPcap::capture,&capture);
+		}
 	}
 
 	{
@@ -524,7 +784,31 @@ main(int argc,char **argv) {
 		if ( opt_verbose )
 			printf("Connecting to %s\n",opt_connect);
 
-		int sock = esp.tcp_connect(opt_connect,opt_port,rx_callback);
+		int sock;
+
+		if ( !opt_async ) {
+			sock = esp.tcp_connect(opt_connect,opt_port,rx_callback,output);
+		} else if ( (sock = esp.tcp_connect_async(opt_connect,opt_port,rx_callback,output,connect_cb)) >= 0 ) {
+			unsigned long polls = 0;
+
+			// Other work could be done while the connect is pending
+			while ( esp.get_state(sock) == ESP8266::SockConnecting ) {
+				esp.receive();
+				esp.advance();
+				++polls;
+			}
+			if ( opt_verbose )
+				printf("Connect completed after %lu polls\n",polls);
+
+			if ( esp.get_state(sock) == ESP8266::SockFailed ) {
+				fprintf(stderr,"%s: Connecting to %s port %d\n",
+					esp.strerror(esp.get_sock_error(sock)),
+					opt_connect,opt_port);
+				esp.close(sock);
+				exit(13);
+			}
+		}
+
 		if ( sock < 0 ) {
 			fprintf(stderr,"%s: Connecting to %s port %d\n",
 				esp.strerror(),
@@ -535,11 +819,12 @@ main(int argc,char **argv) {
 		if ( opt_verbose )
 			printf("Opened socket %d\n",sock);
 
-		int sent = esp.write(sock,"GET /\r\n",7);
+		int sent = opt_file ? upload(esp,sock) : esp.write(sock,"GET /\r\n",7);
 		if ( opt_verbose )
 			printf("Sent %d bytes\n",sent);
 
 		ok = esp.close(sock);
+		esp.dispatch();			// Output queued by -q
 		if ( !ok ) {
 			fprintf(stderr,"%s: close socket %d\n",
 				esp.strerror(),
@@ -582,6 +867,7 @@ main(int argc,char **argv) {
 
 			do	{
 				esp.receive();
+				esp.dispatch();
 			} while ( time(0) - time0 < opt_Z );
 
 			printf("End UDP wait period.\n");
@@ -602,7 +888,7 @@ main(int argc,char **argv) {
 	//////////////////////////////////////////////////////////////
 
 	if ( opt_listen >= 0 ) {
-		ok = esp.listen(opt_listen,accept_cb);
+		ok = esp.listen(opt_listen,accept_cb,&esp);
 		if ( !ok )
 			fprintf(stderr,"Listen failed.\n");
 		else if ( opt_verbose )
@@ -610,6 +896,7 @@ main(int argc,char **argv) {
 
 		for (;;) {
 			esp.receive();
+			esp.dispatch();
 			usleep(10);
 		}
 	}
@@ -618,12 +905,32 @@ main(int argc,char **argv) {
 	// Close serial device
 	//////////////////////////////////////////////////////////////
 
+	if ( queue && opt_verbose )
+		printf("Queue overflows: %lu\n",esp.get_overflows());
+	if ( opt_verbose )
+		printf("UART overrun signs: %lu +IPD length errors, %lu garbled lines\n",
+			esp.get_ipd_errors(),esp.get_line_errors());
+
 	fflush(output);
 	if ( opt_output )
 		fclose(output);
 
-	close(fd);
-	fd = -1;
+	if ( opt_capture ) {
+		esp.set_capture(0);
+		if ( opt_verbose )
+			printf("Captured %lu frames to %s\n",capture.get_frames(),opt_capture);
+		capture.close();
+	}
+
+	if ( opt_net ) {
+		if ( opt_verbose )
+			printf("Serial server: %lu segments sent, round trip min %lu us, avg %lu us (%lu samples)\n",
+				netser.get_tx_segments(),
+				netser.get_rtt_min(),
+				netser.get_rtt_avg(),
+				netser.get_rtt_samples());
+		netser.close();
+	} else	close(fd);
 	return 0;
 }
 
@@ -0,0 +1,339 @@
+///////////////////////////////////////////////////////////////////////
+// sertcp.cpp -- Minimal ser2net style serial server, for testing
+// Date: Sun Oct 18 22:20:13 2026
+///////////////////////////////////////////////////////////////////////
+//
+// Shares a local serial device with one TCP client at a time, so that
+// ESPNetSerial (posix -n/-N) can be tried without a terminal server:
+//
+//	$ ./sertcp -d /dev/ttyUSB0 -p 2217 -r &
+//	$ ./posix -N localhost:2217 -v ...
+//
+// Without -r the bytes are relayed as is (ser2net "raw"). With -r the
+// client speaks Telnet with COM-PORT-OPTION (RFC 2217): IAC escapes
+// are undone, and SET-BAUDRATE is applied and acknowledged. Other
+// COM-PORT settings are acknowledged only.
+//
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static int opt_baudrate = 115200;
+static int opt_port = 2217;
+static bool opt_rfc2217 = false;
+static bool opt_verbose = false;
+static const char *opt_device = "/dev/cu.usbserial-A50285BI";
+
+enum {				// Telnet (RFC 854) and COM-PORT-OPTION (RFC 2217)
+	IAC = 255, WILL = 251, DO = 253, SB = 250, SE = 240,
+	OptComPort = 44, CpSetBaudrate = 1, CpServer = 100
+};
+
+static int sfd = -1;			// Serial device
+
+//////////////////////////////////////////////////////////////////////
+// Write all bytes (blocking)
+//////////////////////////////////////////////////////////////////////
+
+static bool
+write_all(int fd,const unsigned char *data,int bytes) {
+	int rc;
+
+	while ( bytes > 0 ) {
+		rc = write(fd,data,bytes);
+		if ( rc > 0 ) {
+			data += rc;
+			bytes -= rc;
+		} else if ( rc == -1 && errno != EINTR && errno != EAGAIN )
+			return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Apply a baud rate to the serial device
+//////////////////////////////////////////////////////////////////////
+
+static void
+set_baudrate(int baudrate) {
+	struct termios ios;
+
+	if ( baudrate <= 0 || tcgetattr(sfd,&ios) == -1 )
+		return;
+	cfsetspeed(&ios,baudrate);
+	tcsetattr(sfd,TCSADRAIN,&ios);
+	if ( opt_verbose )
+		printf("Baud rate %d\n",baudrate);
+}
+
+//////////////////////////////////////////////////////////////////////
+// RFC 2217 client to serial decoder
+//////////////////////////////////////////////////////////////////////
+
+struct s_telnet {
+	int		state;			// 0 data, 1 IAC, 2 option, 3 SB, 4 SB IAC
+	unsigned char	sb[16];			// Subnegotiation bytes
+	int		sblen;
+};
+
+static void
+subneg(int cfd,s_telnet& tn) {
+	unsigned char reply[24];
+	int n = 0;
+
+	if ( tn.sblen < 2 || tn.sb[0] != OptComPort )
+		return;
+
+	if ( tn.sb[1] == CpSetBaudrate && tn.sblen >= 6 )
+		set_baudrate(tn.sb[2] << 24 | tn.sb[3] << 16 | tn.sb[4] << 8 | tn.sb[5]);
+
+	reply[n++] = IAC;
+	reply[n++] = SB;
+	reply[n++] = OptComPort;
+	reply[n++] = tn.sb[1] + CpServer;
+	for ( int x=2; x<tn.sblen; ++x ) {
+		reply[n++] = tn.sb[x];
+		if ( tn.sb[x] == IAC )
+			reply[n++] = IAC;
+	}
+	reply[n++] = IAC;
+	reply[n++] = SE;
+	write_all(cfd,reply,n);
+}
+
+static int
+decode(int cfd,s_telnet& tn,unsigned char *buf,int bytes) {
+	int out = 0;
+
+	for ( int x=0; x<bytes; ++x ) {
+		unsigned char b = buf[x];
+
+		switch ( tn.state ) {
+		case 0:
+			if ( b == IAC )
+				tn.state = 1;
+			else	buf[out++] = b;
+			break;
+		case 1:
+			if ( b == IAC ) {
+				buf[out++] = b;
+				tn.state = 0;
+			} else if ( b >= WILL )
+				tn.state = 2;
+			else if ( b == SB ) {
+				tn.sblen = 0;
+				tn.state = 3;
+			} else	tn.state = 0;
+			break;
+		case 2:				// Option accepted silently
+			tn.state = 0;
+			break;
+		case 3:
+			if ( b == IAC )
+				tn.state = 4;
+			else if ( tn.sblen < int(sizeof tn.sb) )
+				tn.sb[tn.sblen++] = b;
+			break;
+		case 4:
+			if ( b == SE ) {
+				subneg(cfd,tn);
+				tn.state = 0;
+			} else	{
+				if ( tn.sblen < int(sizeof tn.sb) )
+					tn.sb[tn.sblen++] = b;
+				tn.state = 3;
+			}
+			break;
+		}
+	}
+	return out;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Relay between the client and the serial device until either closes
+//////////////////////////////////////////////////////////////////////
+
+static void
+serve(int cfd) {
+	struct pollfd fds[2];
+	unsigned char buf[1024], esc[2048];
+	s_telnet tn;
+	int n;
+
+	memset(&tn,0,sizeof tn);
+
+	if ( opt_rfc2217 ) {
+		static const unsigned char nego[] = { IAC, DO, OptComPort, IAC, WILL, 0, IAC, DO, 0 };
+
+		write_all(cfd,nego,sizeof nego);
+	}
+
+	fds[0].fd = cfd;
+	fds[1].fd = sfd;
+	fds[0].events = fds[1].events = POLLIN;
+
+	for (;;) {
+		if ( poll(fds,2,-1) == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			return;
+		}
+
+		if ( fds[0].revents ) {
+			if ( (n = read(cfd,buf,sizeof buf)) <= 0 )
+				return;
+			if ( opt_rfc2217 )
+				n = decode(cfd,tn,buf,n);
+			if ( !write_all(sfd,buf,n) )
+				return;
+		}
+
+		if ( fds[1].revents ) {
+			if ( (n = read(sfd,buf,sizeof buf)) <= 0 ) {
+				if ( n == -1 && errno == EAGAIN )
+					continue;
+				return;
+			}
+			if ( opt_rfc2217 ) {
+				int e = 0;
+
+				for ( int x=0; x<n; ++x ) {
+					esc[e++] = buf[x];
+					if ( buf[x] == IAC )
+						esc[e++] = IAC;
+				}
+				if ( !write_all(cfd,esc,e) )
+					return;
+			} else if ( !write_all(cfd,buf,n) )
+				return;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Command line usage
+//////////////////////////////////////////////////////////////////////
+
+static void
+usage(const char *cmd) {
+	const char *cp = strrchr(cmd,'/');
+
+	if ( cp )
+		cmd = cp + 1;
+
+	fprintf(stderr,
+		"Usage: %s [-b baudrate] [-d device] [-p port] [-r] [-v] [-h]\n"
+		"where options include:\n"
+		"\t-b baudrate\tSerial baud rate (115200)\n"
+		"\t-d device\tSerial device pathname\n"
+		"\t-p port\t\tTCP port to listen on (2217)\n"
+		"\t-r\t\tRFC 2217 (Telnet COM-PORT-OPTION), else raw\n"
+		"\t-v\t\tVerbose output mode\n"
+		"\t-h\t\tThis help info.\n",
+		cmd);
+	exit(0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Serve clients one at a time until interrupted
+//////////////////////////////////////////////////////////////////////
+
+int
+main(int argc,char **argv) {
+	static const char options[] = ":b:d:p:rvh";
+	struct sockaddr_in sin;
+	struct termios ios;
+	int optch, er = 0, lfd, cfd, on = 1;
+
+	while ( (optch = getopt(argc,argv,options)) != -1 ) {
+		switch ( optch ) {
+		case 'b':
+			opt_baudrate = atoi(optarg);
+			break;
+		case 'd':
+			opt_device = optarg;
+			break;
+		case 'p':
+			opt_port = atoi(optarg);
+			break;
+		case 'r':
+			opt_rfc2217 = true;
+			break;
+		case 'v':
+			opt_verbose = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			break;
+		case ':':
+			fprintf(stderr,"Missing argument for -%c\n",optopt);
+			++er;
+			break;
+		default:
+			fprintf(stderr,"Invalid option -%c\n",optopt);
+			++er;
+		}
+	}
+
+	if ( er > 0 ) {
+		fprintf(stderr,"Use option -h for more information.\n");
+		exit(1);
+	}
+
+	signal(SIGPIPE,SIG_IGN);
+
+	if ( (sfd = open(opt_device,O_RDWR|O_NOCTTY|O_NONBLOCK)) == -1 || tcgetattr(sfd,&ios) == -1 ) {
+		fprintf(stderr,"%s: Opening serial device %s for r/w\n",
+			strerror(errno),
+			opt_device);
+		exit(3);
+	}
+
+	cfmakeraw(&ios);
+	cfsetspeed(&ios,opt_baudrate);
+	ios.c_cflag |= CRTSCTS;		// Hardware flow control on
+	tcsetattr(sfd,TCSADRAIN,&ios);
+
+	memset(&sin,0,sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(opt_port);
+	sin.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if ( (lfd = socket(AF_INET,SOCK_STREAM,0)) == -1
+	  || setsockopt(lfd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof on) == -1
+	  || bind(lfd,(struct sockaddr *)&sin,sizeof sin) == -1
+	  || listen(lfd,1) == -1 ) {
+		fprintf(stderr,"%s: Listening on port %d\n",strerror(errno),opt_port);
+		exit(4);
+	}
+
+	if ( opt_verbose )
+		printf("Serving %s on port %d (%s)\n",opt_device,opt_port,opt_rfc2217 ? "RFC 2217" : "raw");
+
+	for (;;) {
+		if ( (cfd = accept(lfd,0,0)) == -1 )
+			continue;
+		setsockopt(cfd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof on);
+		if ( opt_verbose )
+			printf("Client connected\n");
+		serve(cfd);
+		close(cfd);
+		if ( opt_verbose )
+			printf("Client disconnected\n");
+	}
+
+	return 0;
+}
+
+// End sertcp.cpp